@@ -315,9 +315,24 @@ static char *getIOFlags(Package pkg)
 #endif
 #ifdef HAVE_ZSTD
 	} else if (rstreq(s+1, "zstdio")) {
+	    const char *d = strchr(rpmio_flags, 'D');
 	    compr = "zstd";
 	    /* Add prereq on rpm version that understands zstd payloads */
 	    (void) rpmlibNeedsFeature(pkg, "PayloadIsZstd", "5.4.18-1");
+	    /* Record the trained dictionary the payload can't be read without */
+	    if (d && d < s) {
+		uint32_t dictid = strtoul(d+1, NULL, 10);
+		if (dictid) {
+		    headerPutUint32(pkg->header, RPMTAG_PAYLOADDICTID, &dictid, 1);
+		    (void) rpmlibNeedsFeature(pkg, "PayloadZstdDict", "4.18.90-1");
+		}
+	    }
+#endif
+#ifdef HAVE_LZ4
+	} else if (rstreq(s+1, "lz4dio")) {
+	    compr = "lz4";
+	    /* Add prereq on rpm version that understands lz4 payloads */
+	    (void) rpmlibNeedsFeature(pkg, "PayloadIsLz4", "4.18.90-1");
 #endif
 	} else {
 	    rpmlog(RPMLOG_ERR, _("Unknown payload compression: %s\n"),
@@ -89,12 +89,21 @@ Header headerCopy(Header h);
 enum headerImportFlags_e {
     HEADERIMPORT_COPY		= (1 << 0), /* Make copy of blob on import? */
     HEADERIMPORT_FAST		= (1 << 1), /* Faster but less safe? */
+    HEADERIMPORT_LAZY		= (1 << 2), /* Decode entries on first access */
+    HEADERIMPORT_KEEP		= (1 << 3), /* Keep export copy for faster re-export */
 };
 
 typedef rpmFlags headerImportFlags;
 
 /** \ingroup header
  * Import header to in-memory representation.
+ *
+ * With HEADERIMPORT_LAZY, region entries are only validated and decoded
+ * on first access. Lookups such as headerGet() then update the header
+ * itself, so a lazily imported header must not be accessed from several
+ * threads at once even if none of them modifies it. Headers returned by
+ * rpmdb iterators are imported this way and may be shared with other
+ * iterators through the database header cache.
  * @param blob		on-disk header blob (i.e. with offsets)
  * @param bsize		on-disk header blob size in bytes (0 if unknown)
  * @param flags		flags to control operation
@@ -143,12 +152,22 @@ enum headerGetFlags_e {
     HEADERGET_RAW 	= (1 << 2), /* return raw contents (no i18n lookups) */
     HEADERGET_ALLOC	= (1 << 3), /* always allocate memory for all data */
     HEADERGET_ARGV	= (1 << 4), /* return string arrays NULL-terminated */
+    HEADERGET_ARENA	= (1 << 5), /* allocate from header, freed with it */
+    HEADERGET_PACKED	= (1 << 6), /* string arrays as a view of header data */
 };
 
+/*
+ * HEADERGET_ARENA and HEADERGET_PACKED memory is bounded per header, past
+ * the limit data is allocated like without them. Use rpmtdFreeData() as
+ * usual, it leaves memory owned by the header alone.
+ */
+
 typedef rpmFlags headerGetFlags;
 
 /** \ingroup header
  * Retrieve tag value.
+ * On lazily imported headers the first retrieval of a tag decodes its
+ * entry in place, see headerImport().
  * @param h		header
  * @param tag		tag
  * @param[out] td	tag data container
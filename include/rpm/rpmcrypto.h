@@ -1,6 +1,7 @@
 #ifndef _RPMCRYPTO_H
 #define _RPMCRYPTO_H
 
+#include <sys/uio.h>
 #include <rpm/rpmtypes.h>
 
 #ifdef __cplusplus
@@ -141,6 +142,18 @@ int rpmDigestBundleAddID(rpmDigestBundle bundle, int algo, int id,
  */
 int rpmDigestBundleUpdate(rpmDigestBundle bundle, const void *data, size_t len);
 
+/** \ingroup rpmcrypto
+ * Update contexts within bundle with a vector of plain text buffers,
+ * as if each were passed to rpmDigestBundleUpdate() in turn. Large
+ * inputs update the contexts in parallel.
+ * @param bundle	digest bundle
+ * @param iov		data buffers
+ * @param iovcnt	no. of data buffers
+ * @return		0 on success
+ */
+int rpmDigestBundleUpdateV(rpmDigestBundle bundle,
+			   const struct iovec *iov, int iovcnt);
+
 /** \ingroup rpmcrypto
  * Return digest from a bundle and destroy context, see rpmDigestFinal().
  *
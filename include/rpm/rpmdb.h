@@ -28,7 +28,11 @@ typedef enum rpmdbOpX_e {
     RPMDB_OP_DBGET              = 1,
     RPMDB_OP_DBPUT              = 2,
     RPMDB_OP_DBDEL              = 3,
-    RPMDB_OP_MAX		= 4
+    RPMDB_OP_DBPREP             = 4,
+    RPMDB_OP_DBSTMT             = 5,
+    RPMDB_OP_HDRCACHE           = 6,
+    RPMDB_OP_HDRLOAD            = 7,
+    RPMDB_OP_MAX		= 8
 } rpmdbOpX;
 
 typedef enum rpmdbCtrlOp_e {
@@ -90,6 +90,7 @@ FD_t	Fdopen(FD_t ofd, const char * fmode);
  * | `xzdio`	| xz                | `r,w,a`	    |
  * | `lzdio`	| lzma (legacy)     | `r,w,a`	    |
  * | `zstdio`	| zstd              | `r,w,a`	    |
+ * | `lz4dio`	| lz4               | `r,w,a`	    |
  *
  * Compression `flags` must be listed in the following order and can be any of:
  * 
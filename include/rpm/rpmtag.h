@@ -386,6 +386,7 @@ typedef enum rpmTag_e {
     RPMTAG_PREUNTRANSFLAGS	= 5107, /* i */
     RPMTAG_POSTUNTRANSFLAGS	= 5108, /* i */
     RPMTAG_SYSUSERS		= 5109, /* s[] extension */
+    RPMTAG_PAYLOADDICTID	= 5110, /* i */
 
     RPMTAG_FIRSTFREE_TAG	/*!< internal */
 } rpmTag;
@@ -21,6 +21,7 @@ enum rpmtdFlags_e {
     RPMTD_IMMUTABLE	= (1 << 2),	/* header data or modifiable? */
     RPMTD_ARGV		= (1 << 3),	/* string array is NULL-terminated? */
     RPMTD_INVALID	= (1 << 4),	/* invalid data (in header) */
+    RPMTD_PACKED	= (1 << 5),	/* string array only accessible via API */
 };
 
 typedef rpmFlags rpmtdFlags;
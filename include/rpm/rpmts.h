@@ -174,7 +174,11 @@ typedef	enum rpmtsOpX_e {
     RPMTS_OP_DBPUT		= 15,
     RPMTS_OP_DBDEL		= 16,
     RPMTS_OP_VERIFY		= 17,
-    RPMTS_OP_MAX		= 18
+    RPMTS_OP_DBPREP		= 18,
+    RPMTS_OP_DBSTMT		= 19,
+    RPMTS_OP_HDRCACHE		= 20,
+    RPMTS_OP_HDRLOAD		= 21,
+    RPMTS_OP_MAX		= 22
 } rpmtsOpX;
 
 enum rpmtxnFlags_e {
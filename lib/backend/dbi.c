@@ -214,11 +214,81 @@ unsigned int pkgdbKey(dbiIndex dbi, dbiCursor dbc)
     return dbi->dbi_rpmdb->db_ops->pkgdbKey(dbi, dbc);
 }
 
+void pkgdbRelease(dbiIndex dbi, dbiCursor dbc)
+{
+    const struct rpmdbOps_s *ops = dbi->dbi_rpmdb->db_ops;
+
+    if (ops->pkgdbRelease && dbc)
+	ops->pkgdbRelease(dbi, dbc);
+}
+
 rpmRC idxdbGet(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_t keylen, dbiIndexSet *set, int curFlags)
 {
     return dbi->dbi_rpmdb->db_ops->idxdbGet(dbi, dbc, keyp, keylen, set, curFlags);
 }
 
+rpmRC idxdbGetMany(dbiIndex dbi, dbiCursor dbc, const char **keys,
+		   const size_t *keylens, int nkeys, dbiIndexSet *sets)
+{
+    const struct rpmdbOps_s *ops = dbi->dbi_rpmdb->db_ops;
+    rpmRC rc = RPMRC_NOTFOUND;
+
+    if (ops->idxdbGetMany)
+	return ops->idxdbGetMany(dbi, dbc, keys, keylens, nkeys, sets);
+
+    for (int i = 0; i < nkeys; i++) {
+	rpmRC xx = ops->idxdbGet(dbi, dbc, keys[i], keylens[i], &sets[i],
+				 DBC_NORMAL_SEARCH);
+	if (xx == RPMRC_OK)
+	    rc = RPMRC_OK;
+	else if (xx != RPMRC_NOTFOUND)
+	    return RPMRC_FAIL;
+    }
+    return rc;
+}
+
+rpmRC idxdbFilter(dbiIndex dbi, dbiCursor dbc, idxmatchfunc match, void *data,
+		  dbiIndexSet *set)
+{
+    const struct rpmdbOps_s *ops = dbi->dbi_rpmdb->db_ops;
+    rpmRC rc = RPMRC_NOTFOUND;
+    rpmRC xx;
+    dbiCursor kc;
+
+    if (ops->idxdbFilter)
+	return ops->idxdbFilter(dbi, dbc, match, data, set);
+
+    /* Walk the keys on a cursor of our own, look up the matches on dbc */
+    kc = dbiCursorInit(dbi, DBC_READ);
+    while ((xx = ops->idxdbGet(dbi, kc, NULL, 0, NULL,
+			       DBC_NORMAL_SEARCH)) == RPMRC_OK) {
+	unsigned int keylen = 0;
+	const char *key = ops->idxdbKey(dbi, kc, &keylen);
+
+	if (key == NULL || !match(data, key, keylen))
+	    continue;
+
+	xx = ops->idxdbGet(dbi, dbc, key, keylen, set, DBC_NORMAL_SEARCH);
+	if (xx == RPMRC_OK)
+	    rc = RPMRC_OK;
+	else if (xx != RPMRC_NOTFOUND)
+	    break;
+    }
+    if (xx != RPMRC_NOTFOUND)
+	rc = RPMRC_FAIL;
+    dbiCursorFree(dbi, kc);
+
+    return rc;
+}
+
+int idxdbKeyCmp(const void *a, size_t alen, const void *b, size_t blen)
+{
+    int rc = memcmp(a, b, (alen < blen) ? alen : blen);
+    if (rc == 0)
+	rc = (alen > blen) - (alen < blen);
+    return rc;
+}
+
 rpmRC idxdbPut(dbiIndex dbi, rpmTagVal rpmtag, unsigned int hdrNum, Header h)
 {
     return dbi->dbi_rpmdb->db_ops->idxdbPut(dbi, rpmtag, hdrNum, h);
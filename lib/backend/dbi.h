@@ -44,6 +44,9 @@ struct rpmdb_s {
     int		db_perms;	/*!< open permissions */
     const char	* db_descr;	/*!< db backend description (for error msgs) */
     struct dbChk_s * db_checked;/*!< headerCheck()'ed package instances */
+    struct hdrCache_s * db_hdrcache;/*!< recently decoded headers */
+    struct rpmdbsum_s * db_summary;/*!< package summary (or NULL) */
+    int		db_sumstate;	/*!< package summary state */
     rpmdb	db_next;
     int		db_opens;
     dbiIndex	db_pkgs;	/*!< Package db */
@@ -62,6 +65,10 @@ struct rpmdb_s {
     struct rpmop_s db_getops;
     struct rpmop_s db_putops;
     struct rpmop_s db_delops;
+    struct rpmop_s db_prepops;
+    struct rpmop_s db_stmtops;
+    struct rpmop_s db_hdrcacheops;
+    struct rpmop_s db_hdrloadops;
 
     int nrefs;			/*!< Reference count. */
 };
@@ -98,6 +105,7 @@ struct dbiIndex_s {
     int dbi_flags;
 
     void * dbi_db;		/*!< Backend private handle */
+    void * dbi_cache;		/*!< Backend private cache handle */
 };
 
 union _dbswap {
@@ -116,6 +124,8 @@ union _dbswap {
 typedef rpmRC (*idxfunc)(dbiIndex dbi, dbiCursor dbc,
 			const char *keyp, size_t keylen, dbiIndexItem rec);
 
+typedef int (*idxmatchfunc)(void *data, const char *keyp, size_t keylen);
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -225,9 +235,55 @@ rpmRC pkgdbGet(dbiIndex dbi, dbiCursor dbc, unsigned int hdrNum,
 RPM_GNUC_INTERNAL
 unsigned int pkgdbKey(dbiIndex dbi, dbiCursor dbc);
 
+/** \ingroup dbi
+ * Release the header blob last returned by pkgdbGet() early. The blob
+ * must not be used afterwards, instead of until the next cursor access.
+ * @param dbi		package database handle
+ * @param dbc		database cursor handle
+ */
+RPM_GNUC_INTERNAL
+void pkgdbRelease(dbiIndex dbi, dbiCursor dbc);
+
 RPM_GNUC_INTERNAL
 rpmRC idxdbGet(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_t keylen,
                dbiIndexSet *set, int curFlags);
+/** \ingroup dbi
+ * Look up several keys of an index at once.
+ * Keys must be unique and sorted in memcmp() order, a shorter key sorting
+ * before a longer one with the same prefix (see idxdbKeyCmp()).
+ * @param dbi		index database handle
+ * @param dbc		database cursor handle
+ * @param keys		array of keys
+ * @param keylens	array of key lengths
+ * @param nkeys		number of keys
+ * @param sets		array of nkeys index sets, matches are added per key
+ * @return		RPMRC_OK if any key matched, RPMRC_NOTFOUND if none,
+ *			RPMRC_FAIL on error
+ */
+RPM_GNUC_INTERNAL
+rpmRC idxdbGetMany(dbiIndex dbi, dbiCursor dbc, const char **keys,
+		   const size_t *keylens, int nkeys, dbiIndexSet *sets);
+
+/** \ingroup dbi
+ * Look up all index keys accepted by a match function.
+ * @param dbi		index database handle
+ * @param dbc		database cursor handle
+ * @param match		key match function, non-zero for a match
+ * @param data		match function private data
+ * @param set		index set, matches of all keys are added here
+ * @return		RPMRC_OK if any key matched, RPMRC_NOTFOUND if none,
+ *			RPMRC_FAIL on error
+ */
+RPM_GNUC_INTERNAL
+rpmRC idxdbFilter(dbiIndex dbi, dbiCursor dbc, idxmatchfunc match, void *data,
+		  dbiIndexSet *set);
+
+/** \ingroup dbi
+ * Compare two index keys in the order expected by idxdbGetMany().
+ */
+RPM_GNUC_INTERNAL
+int idxdbKeyCmp(const void *a, size_t alen, const void *b, size_t blen);
+
 RPM_GNUC_INTERNAL
 rpmRC idxdbPut(dbiIndex dbi, rpmTagVal rpmtag, unsigned int hdrNum, Header h);
 
@@ -254,8 +310,14 @@ struct rpmdbOps_s {
     rpmRC (*pkgdbPut)(dbiIndex dbi, dbiCursor dbc, unsigned int *hdrNum, unsigned char *hdrBlob, unsigned int hdrLen);
     rpmRC (*pkgdbDel)(dbiIndex dbi, dbiCursor dbc,  unsigned int hdrNum);
     unsigned int (*pkgdbKey)(dbiIndex dbi, dbiCursor dbc);
+    /* optional, blobs are just left until the next cursor access if not set */
+    void (*pkgdbRelease)(dbiIndex dbi, dbiCursor dbc);
 
     rpmRC (*idxdbGet)(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_t keylen, dbiIndexSet *set, int curFlags);
+    /* optional, idxdbGet() is used per key when not set */
+    rpmRC (*idxdbGetMany)(dbiIndex dbi, dbiCursor dbc, const char **keys, const size_t *keylens, int nkeys, dbiIndexSet *sets);
+    /* optional, keys are walked and matched one by one when not set */
+    rpmRC (*idxdbFilter)(dbiIndex dbi, dbiCursor dbc, idxmatchfunc match, void *data, dbiIndexSet *set);
     rpmRC (*idxdbPut)(dbiIndex dbi, rpmTagVal rpmtag, unsigned int hdrNum, Header h);
     rpmRC (*idxdbDel)(dbiIndex dbi, rpmTagVal rpmtag, unsigned int hdrNum, Header h);
     const void * (*idxdbKey)(dbiIndex dbi, dbiCursor dbc, unsigned int *keylen);
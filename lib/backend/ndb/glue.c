@@ -25,6 +25,8 @@ struct dbiCursor_s {
     unsigned int nlist;
     unsigned int ilist;
     unsigned char *listdata;
+
+    int maplocked;	/* holding a lock for a mapped blob */
 };
 
 struct ndbEnv_s {
@@ -286,9 +288,48 @@ static dbiCursor ndb_CursorInit(dbiIndex dbi, unsigned int flags)
     return dbc;
 }
 
+/* Read-only opens get blobs straight from a mapping of Packages.db */
+static int useMapped(dbiCursor dbc)
+{
+    rpmdb rdb = dbc->dbi->dbi_rpmdb;
+    return (dbc->dbi->dbi_flags & DBI_RDONLY) &&
+	   !(rdb->db_flags & RPMDB_FLAG_SALVAGE);
+}
+
+static void unmapBlob(dbiCursor dbc)
+{
+    if (dbc->maplocked) {
+	rpmpkgUnlock(dbc->dbi->dbi_db, 0);
+	dbc->maplocked = 0;
+    }
+}
+
+/*
+ * Blobs are only valid until the next cursor access, so a mapped blob
+ * can be handed out as is. Keep a shared lock until then to prevent
+ * writers from changing it under the caller, rpmdb releases it early
+ * with pkgdbRelease() as soon as it has its own copy.
+ */
+static int mapBlob(dbiCursor dbc, unsigned int hdrNum, unsigned char **hdrBlob, unsigned int *hdrLen)
+{
+    rpmpkgdb pkgdb = dbc->dbi->dbi_db;
+    int rc;
+
+    unmapBlob(dbc);
+    if (rpmpkgLock(pkgdb, 0))
+	return RPMRC_FAIL;
+    rc = rpmpkgGetMapped(pkgdb, hdrNum, hdrBlob, hdrLen);
+    if (rc)
+	rpmpkgUnlock(pkgdb, 0);
+    else
+	dbc->maplocked = 1;
+    return rc;
+}
+
 static dbiCursor ndb_CursorFree(dbiIndex dbi, dbiCursor dbc)
 {
     if (dbc) {
+	unmapBlob(dbc);
 	if (dbc->list)
 	    free(dbc->list);
 	if (dbc->listdata)
@@ -361,13 +402,17 @@ static rpmRC ndb_pkgdbIter(dbiIndex dbi, dbiCursor dbc, unsigned char **hdrBlob,
 	}
 	*hdrBlob = 0;
 	hdrNum = dbc->list[dbc->ilist];
-	rc = rpmpkgGet(dbc->dbi->dbi_db, hdrNum, hdrBlob, hdrLen);
+	if (useMapped(dbc))
+	    rc = mapBlob(dbc, hdrNum, hdrBlob, hdrLen);
+	else
+	    rc = rpmpkgGet(dbc->dbi->dbi_db, hdrNum, hdrBlob, hdrLen);
 	if (rc && rc != RPMRC_NOTFOUND)
 	    break;
 	dbc->ilist++;
 	if (!rc) {
 	    dbc->hdrNum = hdrNum;
-	    setdata(dbc, hdrNum, *hdrBlob, *hdrLen);
+	    if (!dbc->maplocked)
+		setdata(dbc, hdrNum, *hdrBlob, *hdrLen);
 	    break;
 	}
     }
@@ -381,6 +426,12 @@ static rpmRC ndb_pkgdbGet(dbiIndex dbi, dbiCursor dbc, unsigned int hdrNum, unsi
 
     if (!hdrNum)
 	return ndb_pkgdbIter(dbi, dbc, hdrBlob, hdrLen);
+    if (useMapped(dbc)) {
+	rc = mapBlob(dbc, hdrNum, hdrBlob, hdrLen);
+	if (!rc)
+	    dbc->hdrNum = hdrNum;
+	return rc;
+    }
     if (hdrNum == ndbenv->hdrNum && ndbenv->data) {
 	*hdrBlob = ndbenv->data;
 	*hdrLen = ndbenv->datalen;
@@ -399,6 +450,11 @@ static unsigned int ndb_pkgdbKey(dbiIndex dbi, dbiCursor dbc)
     return dbc->hdrNum;
 }
 
+static void ndb_pkgdbRelease(dbiIndex dbi, dbiCursor dbc)
+{
+    unmapBlob(dbc);
+}
+
 
 static void addtoset(dbiIndexSet *set, unsigned int *pkglist, unsigned int pkglistn)
 {
@@ -506,6 +562,28 @@ static rpmRC ndb_idxdbGet(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_t
     return rc;
 }
 
+static rpmRC ndb_idxdbGetMany(dbiIndex dbi, dbiCursor dbc, const char **keys, const size_t *keylens, int nkeys, dbiIndexSet *sets)
+{
+    int i, rc;
+    unsigned int *keyls = xmalloc(nkeys * sizeof(*keyls));
+    unsigned int **pkglists = xmalloc(nkeys * sizeof(*pkglists));
+    unsigned int *pkglistns = xmalloc(nkeys * sizeof(*pkglistns));
+
+    for (i = 0; i < nkeys; i++)
+	keyls[i] = keylens[i];
+    rc = rpmidxGetMany(dbc->dbi->dbi_db, nkeys, (const unsigned char **)keys, keyls, pkglists, pkglistns);
+    for (i = 0; i < nkeys; i++) {
+	if (pkglistns[i])
+	    addtoset(sets + i, pkglists[i], pkglistns[i]);
+	else if (pkglists[i])
+	    free(pkglists[i]);
+    }
+    free(keyls);
+    free(pkglists);
+    free(pkglistns);
+    return rc;
+}
+
 static rpmRC ndb_idxdbPutOne(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_t keylen, dbiIndexItem rec)
 {
     return rpmidxPut(dbc->dbi->dbi_db, (const unsigned char *)keyp, keylen, rec->hdrNum, rec->tagNum);
@@ -552,8 +630,10 @@ struct rpmdbOps_s ndb_dbops = {
     .pkgdbDel	= ndb_pkgdbDel,
     .pkgdbGet	= ndb_pkgdbGet,
     .pkgdbKey	= ndb_pkgdbKey,
+    .pkgdbRelease	= ndb_pkgdbRelease,
 
     .idxdbGet	= ndb_idxdbGet,
+    .idxdbGetMany	= ndb_idxdbGetMany,
     .idxdbPut	= ndb_idxdbPut,
     .idxdbDel	= ndb_idxdbDel,
     .idxdbKey	= ndb_idxdbKey
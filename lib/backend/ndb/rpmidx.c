@@ -780,6 +780,26 @@ static int rpmidxListSort_cmp(const void *a, const void *b)
     return ((unsigned int *)a)[1] - ((unsigned int *)b)[1];
 }
 
+/* look up many keys, visiting them in hash slot order for sequential access */
+static int rpmidxGetManyInternal(rpmidxdb idxdb, unsigned int nkeys, const unsigned char **keys, const unsigned int *keyls, unsigned int **pkgidxlists, unsigned int *pkgidxnums)
+{
+    unsigned int i, *arr;
+    int rc = RPMRC_NOTFOUND;
+    arr = xmalloc(nkeys * 2 * sizeof(unsigned int));
+    for (i = 0; i < nkeys; i++) {
+	arr[2 * i] = i;
+	arr[2 * i + 1] = murmurhash(keys[i], keyls[i]) & idxdb->hmask;
+    }
+    qsort(arr, nkeys, 2 * sizeof(unsigned int), rpmidxListSort_cmp);
+    for (i = 0; i < nkeys; i++) {
+	unsigned int k = arr[2 * i];
+	if (rpmidxGetInternal(idxdb, keys[k], keyls[k], pkgidxlists + k, pkgidxnums + k) == RPMRC_OK)
+	    rc = RPMRC_OK;
+    }
+    free(arr);
+    return rc;
+}
+
 /* sort in hash offset order, so that we get sequential acceess */
 static void rpmidxListSort(rpmidxdb idxdb, unsigned int *keylist, unsigned int nkeylist, unsigned char *data)
 {
@@ -994,6 +1014,18 @@ int rpmidxGet(rpmidxdb idxdb, const unsigned char *key, unsigned int keyl, unsig
     return rc;
 }
 
+int rpmidxGetMany(rpmidxdb idxdb, unsigned int nkeys, const unsigned char **keys, const unsigned int *keyls, unsigned int **pkgidxlists, unsigned int *pkgidxnums)
+{
+    int rc;
+    memset(pkgidxlists, 0, nkeys * sizeof(*pkgidxlists));
+    memset(pkgidxnums, 0, nkeys * sizeof(*pkgidxnums));
+    if (rpmidxLockReadHeader(idxdb, 0))
+	return RPMRC_FAIL;
+    rc = rpmidxGetManyInternal(idxdb, nkeys, keys, keyls, pkgidxlists, pkgidxnums);
+    rpmidxUnlock(idxdb, 0);
+    return rc;
+}
+
 int rpmidxList(rpmidxdb idxdb, unsigned int **keylistp, unsigned int *nkeylistp, unsigned char **datap)
 {
     int rc;
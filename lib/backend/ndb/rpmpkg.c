@@ -5,6 +5,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -54,6 +55,10 @@ typedef struct rpmpkgdb_s {
     char *filename;
     unsigned int fileblks;	/* file size in blks */
     int dofsync;
+
+    unsigned char *mapped;	/* read-only mapping of the file */
+    size_t mappedlen;
+    unsigned int mapgeneration;	/* generation the mapping was made for */
 } * rpmpkgdb;
 
 
@@ -587,6 +592,63 @@ static int rpmpkgReadBlob(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned int blko
     return RPMRC_OK;
 }
 
+/* (re-)map the file if it changed since the last time */
+static int rpmpkgMap(rpmpkgdb pkgdb)
+{
+    size_t len = (size_t)pkgdb->fileblks * BLK_SIZE;
+    void *mapped;
+
+    if (pkgdb->mapped && pkgdb->mapgeneration == pkgdb->generation)
+	return RPMRC_OK;
+    if (pkgdb->mapped && pkgdb->mappedlen == len) {
+	pkgdb->mapgeneration = pkgdb->generation;
+	return RPMRC_OK;
+    }
+    if (pkgdb->mapped) {
+	munmap(pkgdb->mapped, pkgdb->mappedlen);
+	pkgdb->mapped = 0;
+	pkgdb->mappedlen = 0;
+    }
+    if (!len)
+	return RPMRC_FAIL;
+    mapped = mmap(0, len, PROT_READ, MAP_SHARED, pkgdb->fd, 0);
+    if (mapped == MAP_FAILED)
+	return RPMRC_FAIL;
+    pkgdb->mapped = mapped;
+    pkgdb->mappedlen = len;
+    pkgdb->mapgeneration = pkgdb->generation;
+    return RPMRC_OK;
+}
+
+/* like rpmpkgReadBlob, but return a pointer into the mapping */
+static int rpmpkgMapBlob(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned int blkoff, unsigned int blkcnt, unsigned char **blobp, unsigned int *bloblp)
+{
+    unsigned char *head, *tail;
+    unsigned int bloblen;
+
+    /* sanity */
+    if (blkcnt <  (BLOBHEAD_SIZE + BLOBTAIL_SIZE + BLK_SIZE - 1) / BLK_SIZE)
+	return RPMRC_FAIL;	/* blkcnt too small */
+    if ((size_t)(blkoff + blkcnt) * BLK_SIZE > pkgdb->mappedlen)
+	return RPMRC_FAIL;	/* not in the mapping */
+    head = pkgdb->mapped + (size_t)blkoff * BLK_SIZE;
+    if (le2h(head) != BLOBHEAD_MAGIC)
+	return RPMRC_FAIL;	/* bad blob */
+    if (le2h(head + 4) != pkgidx)
+	return RPMRC_FAIL;	/* bad blob */
+    bloblen = le2h(head + 12);
+    if (blkcnt != (BLOBHEAD_SIZE + bloblen + BLOBTAIL_SIZE + BLK_SIZE - 1) / BLK_SIZE)
+	return RPMRC_FAIL;	/* bad blob */
+    tail = head + (size_t)blkcnt * BLK_SIZE - BLOBTAIL_SIZE;
+    if (le2h(tail + 4) != bloblen)
+	return RPMRC_FAIL;	/* bad blob, bloblen mismatch */
+    if (le2h(tail + 8) != BLOBTAIL_MAGIC)
+	return RPMRC_FAIL;	/* bad blob */
+    *blobp = head + BLOBHEAD_SIZE;
+    *bloblp = bloblen;
+    return RPMRC_OK;
+}
+
 static int rpmpkgVerifyblob(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned int blkoff, unsigned int blkcnt)
 {
     unsigned char buf[65536];
@@ -895,6 +957,9 @@ void rpmpkgClose(rpmpkgdb pkgdb)
 	close(pkgdb->fd);
 	pkgdb->fd = -1;
     }
+    if (pkgdb->mapped)
+	munmap(pkgdb->mapped, pkgdb->mappedlen);
+    pkgdb->mapped = 0;
     if (pkgdb->slots)
 	free(pkgdb->slots);
     pkgdb->slots = 0;
@@ -1083,6 +1148,22 @@ static int rpmpkgGetInternal(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned char
     return RPMRC_OK;
 }
 
+static int rpmpkgGetMappedInternal(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned char **blobp, unsigned int *bloblp)
+{
+    pkgslot *slot;
+
+    if (!pkgdb->slots && rpmpkgReadSlots(pkgdb)) {
+	return RPMRC_FAIL;
+    }
+    slot = rpmpkgFindSlot(pkgdb, pkgidx);
+    if (!slot) {
+	return RPMRC_NOTFOUND;
+    }
+    if (rpmpkgMap(pkgdb))
+	return RPMRC_FAIL;
+    return rpmpkgMapBlob(pkgdb, pkgidx, slot->blkoff, slot->blkcnt, blobp, bloblp);
+}
+
 static int rpmpkgPutInternal(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned char *blob, unsigned int blobl)
 {
     unsigned int blkcnt, blkoff, slotno;
@@ -1279,6 +1360,25 @@ int rpmpkgGet(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned char **blobp, unsign
     return rc;
 }
 
+/* Return the blob without copying. Nothing must change it while it's
+ * in use, so the caller needs to hold a lock until then. */
+int rpmpkgGetMapped(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned char **blobp, unsigned int *bloblp)
+{
+    int rc;
+
+    *blobp = 0;
+    *bloblp = 0;
+    if (!pkgidx)
+	return RPMRC_FAIL;
+    if (!pkgdb->locked_shared && !pkgdb->locked_excl)
+	return RPMRC_FAIL;
+    if (rpmpkgLockReadHeader(pkgdb, 0))
+	return RPMRC_FAIL;
+    rc = rpmpkgGetMappedInternal(pkgdb, pkgidx, blobp, bloblp);
+    rpmpkgUnlock(pkgdb, 0);
+    return rc;
+}
+
 int rpmpkgPut(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned char *blob, unsigned int blobl)
 {
     int rc;
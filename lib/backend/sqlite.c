@@ -13,9 +13,20 @@
 
 static const int sleep_ms = 50;
 
+/* Max. no. of prepared statements cached per dbi */
+#define STMT_CACHE_SIZE 8
+
+struct stmtCache_s {
+    char *sql;
+    sqlite3_stmt *stmt;
+    int inuse;
+};
+
 struct dbiCursor_s {
     sqlite3 *sdb;
+    dbiIndex dbi;
     sqlite3_stmt *stmt;
+    struct stmtCache_s *sc;	/*!< cache slot of stmt, if any */
     const char *fmt;
     int flags;
     rpmTagVal tag;
@@ -44,6 +55,26 @@ static void rpm_match3(sqlite3_context *sctx, int argc, sqlite3_value **argv)
     sqlite3_result_int(sctx, match);
 }
 
+struct keyFilter_s {
+    idxmatchfunc match;
+    void *data;
+};
+
+/* keyfilter(key, filter): run an idxdbFilter() match function on a key */
+static void rpm_keyfilter(sqlite3_context *sctx, int argc, sqlite3_value **argv)
+{
+    int match = 0;
+    if (argc == 2) {
+	struct keyFilter_s *kf = sqlite3_value_pointer(argv[1], "rpmKeyFilter");
+	if (kf) {
+	    const char *key = sqlite3_value_blob(argv[0]);
+	    int keylen = sqlite3_value_bytes(argv[0]);
+	    match = kf->match(kf->data, key, keylen);
+	}
+    }
+    sqlite3_result_int(sctx, match);
+}
+
 static void errCb(void *data, int err, const char *msg)
 {
     rpmdb rdb = data;
@@ -71,6 +102,74 @@ static int dbiCursorResult(dbiCursor dbc)
     return err ? RPMRC_FAIL : RPMRC_OK;
 }
 
+/*
+ * Cursors mostly run one of a handful of fixed statements per dbi, but
+ * a new cursor is created for every lookup. Keep the compiled statements
+ * around per dbi, keyed by the SQL text, and hand out an idle one when
+ * available. A statement can only serve one cursor at a time though,
+ * so concurrent users of the same SQL fall back to a private statement.
+ */
+static sqlite3_stmt *stmtCacheGet(dbiCursor dbc, const char *sql)
+{
+    struct stmtCache_s *cache = dbc->dbi->dbi_cache;
+
+    for (int i = 0; cache && i < STMT_CACHE_SIZE && cache[i].sql; i++) {
+	struct stmtCache_s *sc = &cache[i];
+	if (!sc->inuse && rstreq(sc->sql, sql)) {
+	    rpmop op = &dbc->dbi->dbi_rpmdb->db_stmtops;
+	    rpmswEnter(op, 0);
+	    sqlite3_reset(sc->stmt);
+	    sqlite3_clear_bindings(sc->stmt);
+	    rpmswExit(op, 0);
+	    sc->inuse = 1;
+	    dbc->sc = sc;
+	    return sc->stmt;
+	}
+    }
+    return NULL;
+}
+
+static void stmtCachePut(dbiCursor dbc, const char *sql)
+{
+    struct stmtCache_s *cache = dbc->dbi->dbi_cache;
+
+    if (cache == NULL)
+	cache = dbc->dbi->dbi_cache = xcalloc(STMT_CACHE_SIZE, sizeof(*cache));
+
+    for (int i = 0; i < STMT_CACHE_SIZE; i++) {
+	struct stmtCache_s *sc = &cache[i];
+	if (sc->sql == NULL) {
+	    sc->sql = xstrdup(sql);
+	    sc->stmt = dbc->stmt;
+	    sc->inuse = 1;
+	    dbc->sc = sc;
+	    break;
+	}
+    }
+}
+
+static void stmtCacheRelease(dbiCursor dbc)
+{
+    /* Reset releases any locks held by the statement */
+    sqlite3_reset(dbc->stmt);
+    sqlite3_clear_bindings(dbc->stmt);
+    dbc->sc->inuse = 0;
+    dbc->sc = NULL;
+    dbc->stmt = NULL;
+}
+
+static void stmtCacheFree(dbiIndex dbi)
+{
+    struct stmtCache_s *cache = dbi->dbi_cache;
+
+    for (int i = 0; cache && i < STMT_CACHE_SIZE && cache[i].sql; i++) {
+	sqlite3_finalize(cache[i].stmt);
+	free(cache[i].sql);
+    }
+    free(cache);
+    dbi->dbi_cache = NULL;
+}
+
 static int dbiCursorPrep(dbiCursor dbc, const char *fmt, ...)
 {
     if (dbc->stmt == NULL) {
@@ -81,7 +180,16 @@ static int dbiCursorPrep(dbiCursor dbc, const char *fmt, ...)
 	cmd = sqlite3_vmprintf(fmt, ap);
 	va_end(ap);
 
-	sqlite3_prepare_v2(dbc->sdb, cmd, -1, &dbc->stmt, NULL);
+	dbc->stmt = stmtCacheGet(dbc, cmd);
+	if (dbc->stmt == NULL) {
+	    rpmop op = &dbc->dbi->dbi_rpmdb->db_prepops;
+	    rpmswEnter(op, 0);
+	    if (sqlite3_prepare_v2(dbc->sdb, cmd, -1,
+				   &dbc->stmt, NULL) == SQLITE_OK) {
+		stmtCachePut(dbc, cmd);
+	    }
+	    rpmswExit(op, 0);
+	}
 	sqlite3_free(cmd);
     } else {
 	dbiCursorReset(dbc);
@@ -107,15 +215,20 @@ static int dbiCursorBindPkg(dbiCursor dbc, unsigned int hnum,
     return dbiCursorResult(dbc);
 }
 
-static int dbiCursorBindIdx(dbiCursor dbc, const void *key, int keylen,
-				dbiIndexItem rec)
+static int dbiCursorBindKey(dbiCursor dbc, int pos,
+				const void *key, int keylen)
 {
-    int rc;
     if (dbc->ctype == SQLITE_TEXT) {
-	rc = sqlite3_bind_text(dbc->stmt, 1, key, keylen, NULL);
+	return sqlite3_bind_text(dbc->stmt, pos, key, keylen, NULL);
     } else {
-	rc = sqlite3_bind_blob(dbc->stmt, 1, key, keylen, NULL);
+	return sqlite3_bind_blob(dbc->stmt, pos, key, keylen, NULL);
     }
+}
+
+static int dbiCursorBindIdx(dbiCursor dbc, const void *key, int keylen,
+				dbiIndexItem rec)
+{
+    int rc = dbiCursorBindKey(dbc, 1, key, keylen);
 
     if (rec) {
 	if (!rc)
@@ -127,6 +240,17 @@ static int dbiCursorBindIdx(dbiCursor dbc, const void *key, int keylen,
     return dbiCursorResult(dbc);
 }
 
+static void setWal(sqlite3 *sdb)
+{
+    if (sqlexec(sdb, "PRAGMA journal_mode = WAL") == 0) {
+	int one = 1;
+	/* Annoying but necessary to support non-privileged readers */
+	sqlite3_file_control(sdb, NULL, SQLITE_FCNTL_PERSIST_WAL, &one);
+	/* Sqlite default threshold is way too low for rpmdb */
+	sqlexec(sdb, "PRAGMA wal_autocheckpoint = 10000");
+    }
+}
+
 static int sqlite_init(rpmdb rdb, const char * dbhome)
 {
     int rc = 0;
@@ -164,6 +288,8 @@ static int sqlite_init(rpmdb rdb, const char * dbhome)
 	sqlite3_create_function(sdb, "match", 3,
 				(SQLITE_UTF8|SQLITE_DETERMINISTIC),
 				NULL, rpm_match3, NULL, NULL);
+	sqlite3_create_function(sdb, "keyfilter", 2, SQLITE_UTF8,
+				NULL, rpm_keyfilter, NULL, NULL);
 
 	/*
 	 * Set an extremely high timeout because we must avoid
@@ -175,14 +301,19 @@ static int sqlite_init(rpmdb rdb, const char * dbhome)
 	sqlexec(sdb, "PRAGMA secure_delete = OFF");
 	sqlexec(sdb, "PRAGMA case_sensitive_like = ON");
 
-	if (sqlite3_db_readonly(sdb, NULL) == 0) {
-	    if (sqlexec(sdb, "PRAGMA journal_mode = WAL") == 0) {
-		int one = 1;
-		/* Annoying but necessary to support non-privileged readers */
-		sqlite3_file_control(sdb, NULL, SQLITE_FCNTL_PERSIST_WAL, &one);
-		/* Sqlite default threshold is way too low for rpmdb */
-		sqlexec(sdb, "PRAGMA wal_autocheckpoint = 10000");
-	    }
+	if (sqlite3_db_readonly(sdb, NULL) == 0 &&
+			(rdb->db_flags & RPMDB_FLAG_REBUILD)) {
+	    /*
+	     * Rebuilding into a fresh database which only gets moved into
+	     * place when complete, so there's nothing to protect here.
+	     * Load it all in one transaction without any journal, the
+	     * indexes are only created at the end (see sqlite_Close()).
+	     */
+	    sqlexec(sdb, "PRAGMA journal_mode = OFF");
+	    sqlexec(sdb, "PRAGMA synchronous = OFF");
+	    sqlexec(sdb, "BEGIN");
+	} else if (sqlite3_db_readonly(sdb, NULL) == 0) {
+	    setWal(sdb);
 	}
 
 	rdb->db_dbenv = sdb;
@@ -203,6 +334,16 @@ static int sqlite_fini(rpmdb rdb)
 	    rdb->db_opens--;
 	} else {
 	    if (sqlite3_db_readonly(sdb, NULL) == 0) {
+		if (rdb->db_flags & RPMDB_FLAG_REBUILD) {
+		    /*
+		     * Leave the new database in the mode others expect. The
+		     * journal mode switch is a transaction of its own, with
+		     * synchronous on it gets the bulk loaded data to disk too.
+		     */
+		    sqlexec(sdb, "COMMIT");
+		    sqlexec(sdb, "PRAGMA synchronous = FULL");
+		    setWal(sdb);
+		}
 		sqlexec(sdb, "PRAGMA optimize");
 		sqlexec(sdb, "PRAGMA wal_checkpoint = TRUNCATE");
 	    }
@@ -337,6 +478,8 @@ static int sqlite_Close(dbiIndex dbi, unsigned int flags)
     int rc = 0;
     if (rdb->db_flags & RPMDB_FLAG_REBUILD)
 	rc = init_index(dbi, rpmTagGetValue(dbi->dbi_file));
+    /* Sqlite refuses to close with unfinalized statements */
+    stmtCacheFree(dbi);
     sqlite_fini(dbi->dbi_rpmdb);
     dbiFree(dbi);
     return rc;
@@ -391,6 +534,9 @@ exit:
 
 static void sqlite_SetFSync(rpmdb rdb, int enable)
 {
+    /* Can't be changed inside the bulk load transaction, and no need */
+    if (sqlite3_get_autocommit(rdb->db_dbenv) == 0)
+	return;
     sqlexec(rdb->db_dbenv,
 	    "PRAGMA synchronous = %s", enable ? "FULL" : "OFF");
 }
@@ -417,6 +563,7 @@ static dbiCursor sqlite_CursorInit(dbiIndex dbi, unsigned int flags)
 {
     dbiCursor dbc = xcalloc(1, sizeof(*dbc));
     dbc->sdb = dbi->dbi_db;
+    dbc->dbi = dbi;
     dbc->flags = flags;
     dbc->tag = rpmTagGetValue(dbi->dbi_file);
     if (rpmTagGetClass(dbc->tag) == RPM_STRING_CLASS) {
@@ -432,7 +579,10 @@ static dbiCursor sqlite_CursorInit(dbiIndex dbi, unsigned int flags)
 static dbiCursor sqlite_CursorFree(dbiIndex dbi, dbiCursor dbc)
 {
     if (dbc) {
-	sqlite3_finalize(dbc->stmt);
+	if (dbc->sc)
+	    stmtCacheRelease(dbc);
+	else
+	    sqlite3_finalize(dbc->stmt);
 	if (dbc->subc)
 	    dbiCursorFree(dbi, dbc->subc);
 	if (dbc->flags & DBC_WRITE)
@@ -563,9 +713,13 @@ static rpmRC sqlite_idxdbByKey(dbiIndex dbi, dbiCursor dbc,
 
     if (searchType == DBC_PREFIX_SEARCH) {
 	rc = dbiCursorPrep(dbc, "SELECT hnum, idx FROM '%q' "
-				"WHERE MATCH(key,'%q',%d) "
+				"WHERE MATCH(key,?,?) "
 				"ORDER BY key",
-				dbi->dbi_file, keyp, keylen);
+				dbi->dbi_file);
+	if (!rc)
+	    rc = dbiCursorBindIdx(dbc, keyp, keylen, NULL);
+	if (!rc)
+	    rc = sqlite3_bind_int(dbc->stmt, 2, keylen);
     } else {
 	rc = dbiCursorPrep(dbc, "SELECT hnum, idx FROM '%q' WHERE key=?",
 			dbi->dbi_file);
@@ -642,6 +796,112 @@ static rpmRC sqlite_idxdbGet(dbiIndex dbi, dbiCursor dbc, const char *keyp, size
     return rc;
 }
 
+/* Number of keys looked up per statement in sqlite_idxdbGetMany() */
+#define IDX_BATCH 32
+
+/*
+ * Look up keys in batches with a single IN() statement. Short batches are
+ * padded by repeating the last key so there's only ever one SQL text to
+ * compile, rows are mapped back to their key by binary search.
+ */
+static rpmRC sqlite_idxdbGetMany(dbiIndex dbi, dbiCursor dbc,
+			    const char **keys, const size_t *keylens,
+			    int nkeys, dbiIndexSet *sets)
+{
+    char params[IDX_BATCH * 2];
+    int found = 0;
+    int rc = 0;
+
+    for (int i = 0; i < IDX_BATCH; i++) {
+	params[i * 2] = '?';
+	params[i * 2 + 1] = ',';
+    }
+    params[IDX_BATCH * 2 - 1] = '\0';
+
+    for (int start = 0; start < nkeys && !rc; start += IDX_BATCH) {
+	int n = nkeys - start;
+	if (n > IDX_BATCH)
+	    n = IDX_BATCH;
+
+	rc = dbiCursorPrep(dbc, "SELECT key, hnum, idx FROM '%q' "
+				"WHERE key IN (%s)",
+				dbi->dbi_file, params);
+	for (int i = 0; i < IDX_BATCH && !rc; i++) {
+	    int k = start + ((i < n) ? i : n - 1);
+	    rc = dbiCursorBindKey(dbc, i + 1, keys[k], keylens[k]);
+	}
+	if (rc) {
+	    dbiCursorResult(dbc);
+	    break;
+	}
+
+	while ((rc = sqlite3_step(dbc->stmt)) == SQLITE_ROW) {
+	    const void *key = (dbc->ctype == SQLITE_TEXT) ?
+				(const void *) sqlite3_column_text(dbc->stmt, 0) :
+				sqlite3_column_blob(dbc->stmt, 0);
+	    size_t keylen = sqlite3_column_bytes(dbc->stmt, 0);
+	    int lo = start, hi = start + n;
+
+	    while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		int cmp = idxdbKeyCmp(keys[mid], keylens[mid], key, keylen);
+		if (cmp == 0) {
+		    if (sets[mid] == NULL)
+			sets[mid] = dbiIndexSetNew(5);
+		    dbiIndexSetAppendOne(sets[mid],
+					 sqlite3_column_int(dbc->stmt, 1),
+					 sqlite3_column_int(dbc->stmt, 2), 0);
+		    found = 1;
+		    break;
+		} else if (cmp < 0) {
+		    lo = mid + 1;
+		} else {
+		    hi = mid;
+		}
+	    }
+	}
+
+	rc = (rc == SQLITE_DONE) ? 0 : dbiCursorResult(dbc);
+    }
+
+    if (rc)
+	return RPMRC_FAIL;
+    return found ? RPMRC_OK : RPMRC_NOTFOUND;
+}
+
+/* Match the keys inside sqlite, only matching rows ever come back */
+static rpmRC sqlite_idxdbFilter(dbiIndex dbi, dbiCursor dbc,
+			    idxmatchfunc match, void *data, dbiIndexSet *set)
+{
+    struct keyFilter_s kf = { match, data };
+    int found = 0;
+    int rc = dbiCursorPrep(dbc, "SELECT hnum, idx FROM '%q' "
+				"WHERE keyfilter(key, ?)",
+				dbi->dbi_file);
+
+    if (!rc)
+	rc = sqlite3_bind_pointer(dbc->stmt, 1, &kf, "rpmKeyFilter", NULL);
+
+    if (!rc) {
+	while ((rc = sqlite3_step(dbc->stmt)) == SQLITE_ROW) {
+	    if (*set == NULL)
+		*set = dbiIndexSetNew(5);
+	    dbiIndexSetAppendOne(*set, sqlite3_column_int(dbc->stmt, 0),
+				 sqlite3_column_int(dbc->stmt, 1), 0);
+	    found = 1;
+	}
+    }
+
+    if (rc != SQLITE_DONE) {
+	dbiCursorResult(dbc);
+	return RPMRC_FAIL;
+    }
+    /* Don't leave a pointer to our stack frame bound */
+    dbiCursorReset(dbc);
+
+    return found ? RPMRC_OK : RPMRC_NOTFOUND;
+}
+
 static rpmRC sqlite_idxdbPutOne(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_t keylen, dbiIndexItem rec)
 {
     int rc = dbiCursorPrep(dbc, "INSERT INTO '%q' VALUES(?, ?, ?)",
@@ -709,6 +969,8 @@ struct rpmdbOps_s sqlite_dbops = {
     .pkgdbKey	= sqlite_pkgdbKey,
 
     .idxdbGet	= sqlite_idxdbGet,
+    .idxdbGetMany	= sqlite_idxdbGetMany,
+    .idxdbFilter	= sqlite_idxdbFilter,
     .idxdbPut	= sqlite_idxdbPut,
     .idxdbDel	= sqlite_idxdbDel,
     .idxdbKey	= sqlite_idxdbKey
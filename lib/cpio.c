@@ -25,6 +25,7 @@
 #include <rpm/rpmarchive.h>
 
 #include "lib/cpio.h"
+#include "rpmio/rpmio_internal.h"	/* fdCopy */
 
 #include "debug.h"
 
@@ -444,6 +445,24 @@ ssize_t rpmcpioRead(rpmcpio_t cpio, void * buf, size_t size)
     return read;
 }
 
+ssize_t rpmcpioCopy(rpmcpio_t cpio, FD_t fd, size_t size)
+{
+    size_t left;
+    off_t copied;
+
+    if ((cpio->mode & O_ACCMODE) != O_RDONLY) {
+        return RPMERR_READ_FAILED;
+    }
+
+    left = cpio->fileend - cpio->offset;
+    size = size > left ? left : size;
+    copied = fdCopy(cpio->fd, fd, size);
+    if (copied < 0)
+        return RPMERR_COPY_FAILED;
+    cpio->offset += copied;
+    return copied;
+}
+
 int rpmcpioClose(rpmcpio_t cpio)
 {
     int rc = 0;
@@ -72,6 +72,19 @@ void rpmcpioSetExpectedFileSize(rpmcpio_t cpio, off_t fsize);
 
 ssize_t rpmcpioRead(rpmcpio_t cpio, void * buf, size_t size);
 
+/**
+ * Copy file content from the payload directly into a file descriptor,
+ * without passing through user space. This only works on uncompressed
+ * payloads, and may copy less than asked for (nothing at all) in which
+ * case the caller is to read the rest normally.
+ * @param cpio		cpio archive
+ * @param fd		file to write to
+ * @param size		max. no. of bytes to copy
+ * @return		no. of bytes copied, RPMERR_COPY_FAILED on error
+ */
+RPM_GNUC_INTERNAL
+ssize_t rpmcpioCopy(rpmcpio_t cpio, FD_t fd, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
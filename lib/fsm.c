@@ -12,6 +12,9 @@
 #ifdef WITH_CAP
 #include <sys/capability.h>
 #endif
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
 
 #include <rpm/rpmte.h>
 #include <rpm/rpmts.h>
@@ -41,6 +44,9 @@ static int strict_erasures = 0;
 #define _dirPerms 0755
 #define _filePerms 0644
 
+/* Default io_uring queue depth if not configured */
+#define _uringDepth 64
+
 enum filestage_e {
     FILE_COMMIT = -1,
     FILE_NONE   = 0,
@@ -68,6 +74,8 @@ static const char * fileActionString(rpmFileAction a);
 static int fsmOpenat(int dirfd, const char *path, int flags, int dir);
 static int fsmClose(int *wfdp);
 
+typedef struct fsmuring_s * fsmuring;
+
 /** \ingroup payload
  * Build path to file from file info, optionally ornamented with suffix.
  * "/" needs special handling to avoid appearing as empty path.
@@ -134,20 +142,26 @@ static int fsmSetFCaps(int fd, int dirfd, const char *path, const char *captxt)
     return rc;
 }
 
+static int fsmFlushIO(void)
+{
+    static int oneshot = 0;
+    static int flush_io = 0;
+
+    if (!oneshot) {
+	flush_io = (rpmExpandNumeric("%{?_flush_io}") > 0);
+	oneshot = 1;
+    }
+    return flush_io;
+}
+
 static int fsmClose(int *wfdp)
 {
     int rc = 0;
     if (wfdp && *wfdp >= 0) {
 	int myerrno = errno;
-	static int oneshot = 0;
-	static int flush_io = 0;
 	int fdno = *wfdp;
 
-	if (!oneshot) {
-	    flush_io = (rpmExpandNumeric("%{?_flush_io}") > 0);
-	    oneshot = 1;
-	}
-	if (flush_io) {
+	if (fsmFlushIO()) {
 	    fsync(fdno);
 	}
 	if (close(fdno))
@@ -758,7 +772,402 @@ static int fsmSetmeta(int fd, int dirfd, const char *path,
     return rc;
 }
 
-static int fsmCommit(int dirfd, char **path, rpmfi fi, rpmFileAction action, const char *suffix)
+/* Finish a commit rename, taking ownership of dest */
+static int fsmCommitDone(rpmfi fi, char **path, char *dest, int nsuffix, int rc)
+{
+    if (!rc) {
+	if (nsuffix) {
+	    char * opath = fsmFsPath(fi, NULL);
+	    rpmlog(RPMLOG_WARNING, _("%s%s created as %s%s\n"),
+		   rpmfiDN(fi), opath, rpmfiDN(fi), dest);
+	    free(opath);
+	}
+	free(*path);
+	*path = dest;
+    } else
+	free(dest);
+    return rc;
+}
+
+static void fsmCommitPost(rpmPlugins plugins, rpmfi fi,
+			  struct filedata_s *fp, int rc, char **failedFile)
+{
+    if (!rc)
+	fp->stage = FILE_COMMIT;
+    else if (*failedFile == NULL)
+	*failedFile = rstrscat(NULL, rpmfiDN(fi), fp->fpath, NULL);
+
+    /* Run fsm file post hook for all plugins for all processed files */
+    rpmpluginsCallFsmFilePost(plugins, fi, fp->fpath,
+			      fp->sb.st_mode, fp->action, rc);
+}
+
+#ifdef HAVE_LIBURING
+/*
+ * Batched execution of file closes and commit renames via io_uring.
+ * The operations are queued up and submitted in one go when the queue
+ * fills up, the directory changes or the caller explicitly flushes.
+ * Completions of commit renames are processed in submission order
+ * to keep plugin hooks and error reporting the same as the synchronous
+ * path. Renames are linked so a failure cancels the ones queued after
+ * it, and the commit loop stops once a failure is known. Only
+ * operations without a fd-based io_uring equivalent (fchown, fchmod,
+ * futimens and the like) stay synchronous.
+ */
+enum fsmopkind_e {
+    FSMOP_FSYNC		= 1,
+    FSMOP_CLOSE		= 2,
+    FSMOP_RENAME	= 3,
+};
+
+struct fsmop_s {
+    enum fsmopkind_e kind;
+    int fd;			/*!< file to sync/close, directory to rename in */
+    int fx;			/*!< file index of rename */
+    const char *path;		/*!< rename source */
+    char *dest;			/*!< rename destination (malloced) */
+    int nsuffix;		/*!< rename destination has .rpmnew suffix */
+    int res;			/*!< result, as in cqe->res */
+    int done;
+};
+
+struct fsmuring_s {
+    struct io_uring ring;
+    int depth;			/*!< max. no. of queued operations */
+    int nops;			/*!< no. of queued operations */
+    struct fsmop_s *ops;
+    int dorename;		/*!< IORING_OP_RENAMEAT supported? */
+    int broken;			/*!< ring failed, run synchronously */
+    int flush_io;
+    int rc;			/*!< sticky error from completions */
+    /* Commit context for rename completions */
+    struct filedata_s *fdata;
+    rpmfi fi;
+    rpmPlugins plugins;
+    char **failedFile;
+};
+
+static fsmuring fsmUringNew(void)
+{
+    int depth = rpmExpandNumeric("%{?_fsm_io_uring}");
+    struct io_uring_probe *probe;
+    fsmuring u;
+    int rc;
+
+    if (depth == 0)
+	return NULL;
+    if (depth < 0)
+	depth = _uringDepth;
+    /* Room for a fsync + close pair at least */
+    if (depth < 2)
+	depth = 2;
+
+    u = xcalloc(1, sizeof(*u));
+    rc = io_uring_queue_init(depth, &u->ring, 0);
+    if (rc < 0) {
+	rpmlog(RPMLOG_DEBUG, "io_uring unavailable (%s), "
+			     "using synchronous file operations\n",
+			     strerror(-rc));
+	free(u);
+	return NULL;
+    }
+
+    probe = io_uring_get_probe_ring(&u->ring);
+    if (probe == NULL || !io_uring_opcode_supported(probe, IORING_OP_CLOSE) ||
+			 !io_uring_opcode_supported(probe, IORING_OP_FSYNC)) {
+	rpmlog(RPMLOG_DEBUG, "io_uring lacks close support, "
+			     "using synchronous file operations\n");
+	if (probe)
+	    io_uring_free_probe(probe);
+	io_uring_queue_exit(&u->ring);
+	free(u);
+	return NULL;
+    }
+    u->dorename = io_uring_opcode_supported(probe, IORING_OP_RENAMEAT);
+    io_uring_free_probe(probe);
+
+    u->depth = depth;
+    u->ops = xcalloc(depth, sizeof(*u->ops));
+    u->flush_io = fsmFlushIO();
+    return u;
+}
+
+/* Execute an operation synchronously, return value as in cqe->res */
+static int fsmUringRunSync(struct fsmop_s *op)
+{
+    int rc = 0;
+    switch (op->kind) {
+    case FSMOP_FSYNC:
+	rc = fsync(op->fd);
+	break;
+    case FSMOP_CLOSE:
+	rc = close(op->fd);
+	break;
+    case FSMOP_RENAME:
+	rc = renameat(op->fd, op->path, op->fd, op->dest);
+	break;
+    }
+    return (rc < 0) ? -errno : 0;
+}
+
+static void fsmUringDone(fsmuring u, struct fsmop_s *op, int res)
+{
+    if (_fsm_debug) {
+	rpmlog(RPMLOG_DEBUG, " %8s (%d [%d]) %s\n", __func__,
+	       op->kind, op->fd, (res < 0 ? strerror(-res) : ""));
+    }
+
+    if (op->kind == FSMOP_RENAME && res == -ECANCELED && u->rc) {
+	/* Not attempted due to an earlier failure, as if never reached */
+	free(op->dest);
+    } else if (op->kind == FSMOP_RENAME) {
+	struct filedata_s *fp = &u->fdata[op->fx];
+	int rc = 0;
+
+	if (res < 0)
+	    rc = (res == -EISDIR) ? RPMERR_EXIST_AS_DIR : RPMERR_RENAME_FAILED;
+
+	rpmfiSetFX(u->fi, op->fx);
+	rc = fsmCommitDone(u->fi, &fp->fpath, op->dest, op->nsuffix, rc);
+	fsmCommitPost(u->plugins, u->fi, fp, rc, u->failedFile);
+	if (rc && !u->rc)
+	    u->rc = rc;
+    }
+    /* Like in the synchronous path, fsync and close errors are ignored */
+    memset(op, 0, sizeof(*op));
+}
+
+/* Give up on the ring, everything from now on is done synchronously */
+static void fsmUringBreak(fsmuring u)
+{
+    io_uring_queue_exit(&u->ring);
+    u->broken = 1;
+}
+
+/* Submit all queued operations and wait for them, return sticky error */
+static int fsmUringFlush(fsmuring u)
+{
+    int inflight = 0;
+    int ndone = 0;
+
+    if (u == NULL)
+	return 0;
+
+    while (ndone < u->nops) {
+	struct io_uring_cqe *cqe = NULL;
+	int rc;
+
+	if (inflight == 0) {
+	    do {
+		rc = io_uring_submit(&u->ring);
+	    } while (rc == -EINTR || rc == -EAGAIN);
+	    if (rc <= 0) {
+		/* Nothing was consumed by the kernel, do it ourselves */
+		rpmlog(RPMLOG_DEBUG, "io_uring submit failed (%s), "
+				     "using synchronous file operations\n",
+				     strerror(-rc));
+		fsmUringBreak(u);
+		for (int i = 0; i < u->nops; i++) {
+		    if (!u->ops[i].done) {
+			u->ops[i].res = fsmUringRunSync(&u->ops[i]);
+			u->ops[i].done = 1;
+		    }
+		}
+		break;
+	    }
+	    inflight = rc;
+	}
+
+	do {
+	    rc = io_uring_wait_cqe(&u->ring, &cqe);
+	} while (rc == -EINTR);
+	if (rc < 0) {
+	    /* Outcome of the in-flight operations is unknown, fail them */
+	    rpmlog(RPMLOG_ERR, _("io_uring wait failed: %s\n"), strerror(-rc));
+	    fsmUringBreak(u);
+	    for (int i = 0; i < u->nops; i++) {
+		if (!u->ops[i].done) {
+		    u->ops[i].res = rc;
+		    u->ops[i].done = 1;
+		}
+	    }
+	    break;
+	}
+
+	u->ops[cqe->user_data].res = cqe->res;
+	u->ops[cqe->user_data].done = 1;
+	io_uring_cqe_seen(&u->ring, cqe);
+	inflight--;
+	ndone++;
+    }
+
+    /* Process in submission order regardless of completion order */
+    for (int i = 0; i < u->nops; i++)
+	fsmUringDone(u, &u->ops[i], u->ops[i].res);
+    u->nops = 0;
+
+    return u->rc;
+}
+
+/* Grab queue slots for n operations, flushing the queue if needed */
+static struct fsmop_s * fsmUringGet(fsmuring u, int n)
+{
+    if (u->nops + n > u->depth)
+	fsmUringFlush(u);
+    u->nops += n;
+    return &u->ops[u->nops - n];
+}
+
+static void fsmUringPrep(fsmuring u, struct fsmop_s *op, unsigned flags)
+{
+    struct io_uring_sqe *sqe;
+
+    if (u->broken) {
+	fsmUringDone(u, op, fsmUringRunSync(op));
+	u->nops--;
+	return;
+    }
+
+    sqe = io_uring_get_sqe(&u->ring);
+    switch (op->kind) {
+    case FSMOP_FSYNC:
+	io_uring_prep_fsync(sqe, op->fd, 0);
+	break;
+    case FSMOP_CLOSE:
+	io_uring_prep_close(sqe, op->fd);
+	break;
+    case FSMOP_RENAME:
+	io_uring_prep_renameat(sqe, op->fd, op->path, op->fd, op->dest, 0);
+	break;
+    }
+    io_uring_sqe_set_flags(sqe, flags);
+    io_uring_sqe_set_data64(sqe, op - u->ops);
+}
+
+static void fsmUringClose(fsmuring u, int *fdp)
+{
+    struct fsmop_s *op;
+    int n;
+
+    if (u == NULL) {
+	fsmClose(fdp);
+	return;
+    }
+    if (*fdp < 0)
+	return;
+
+    n = u->flush_io ? 2 : 1;
+    op = fsmUringGet(u, n);
+    if (u->flush_io) {
+	op->kind = FSMOP_FSYNC;
+	op->fd = *fdp;
+	/* Hard link so the close happens even if fsync fails */
+	fsmUringPrep(u, op, IOSQE_IO_HARDLINK);
+	op++;
+    }
+    op->kind = FSMOP_CLOSE;
+    op->fd = *fdp;
+    fsmUringPrep(u, op, 0);
+    *fdp = -1;
+}
+
+/* Queue a commit rename, return -1 if it needs doing synchronously */
+static int fsmUringRename(fsmuring u, int dirfd, const char *path,
+			  char *dest, int fx, int nsuffix)
+{
+    struct fsmop_s *op;
+
+    if (u == NULL || !u->dorename || u->fdata == NULL)
+	return -1;
+
+    removeSBITS(dirfd, dest);
+    op = fsmUringGet(u, 1);
+    op->kind = FSMOP_RENAME;
+    op->fd = dirfd;
+    op->fx = fx;
+    op->path = path;
+    op->dest = dest;
+    op->nsuffix = nsuffix;
+    fsmUringPrep(u, op, IOSQE_IO_LINK);
+    return 0;
+}
+
+/* Flush a full queue (or if asked) and return queued rename errors */
+static int fsmUringCheck(fsmuring u, int flush)
+{
+    if (u == NULL)
+	return 0;
+    if (flush || u->nops >= u->depth)
+	fsmUringFlush(u);
+    return u->rc;
+}
+
+static void fsmUringCommitBegin(fsmuring u, struct filedata_s *fdata,
+				rpmfiles files, rpmPlugins plugins,
+				char **failedFile)
+{
+    if (u == NULL)
+	return;
+    u->fdata = fdata;
+    /* Private iterator for completions, the caller's one moves on */
+    u->fi = rpmfilesIter(files, RPMFI_ITER_FWD);
+    u->plugins = plugins;
+    u->failedFile = failedFile;
+}
+
+static fsmuring fsmUringFree(fsmuring u)
+{
+    if (u) {
+	fsmUringFlush(u);
+	if (!u->broken)
+	    io_uring_queue_exit(&u->ring);
+	rpmfiFree(u->fi);
+	free(u->ops);
+	free(u);
+    }
+    return NULL;
+}
+#else
+static fsmuring fsmUringNew(void)
+{
+    return NULL;
+}
+
+static int fsmUringFlush(fsmuring u)
+{
+    return 0;
+}
+
+static void fsmUringClose(fsmuring u, int *fdp)
+{
+    fsmClose(fdp);
+}
+
+static int fsmUringRename(fsmuring u, int dirfd, const char *path,
+			  char *dest, int fx, int nsuffix)
+{
+    return -1;
+}
+
+static int fsmUringCheck(fsmuring u, int flush)
+{
+    return 0;
+}
+
+static void fsmUringCommitBegin(fsmuring u, struct filedata_s *fdata,
+				rpmfiles files, rpmPlugins plugins,
+				char **failedFile)
+{
+}
+
+static fsmuring fsmUringFree(fsmuring u)
+{
+    return NULL;
+}
+#endif
+
+static int fsmCommit(fsmuring u, int dirfd, char **path, rpmfi fi,
+		     rpmFileAction action, const char *suffix, int *queued)
 {
     int rc = 0;
 
@@ -772,18 +1181,13 @@ static int fsmCommit(int dirfd, char **path, rpmfi fi, rpmFileAction action, con
 
 	/* Rename temporary to final file name if needed. */
 	if (dest != *path) {
-	    rc = fsmRename(dirfd, *path, dirfd, dest);
-	    if (!rc) {
-		if (nsuffix) {
-		    char * opath = fsmFsPath(fi, NULL);
-		    rpmlog(RPMLOG_WARNING, _("%s%s created as %s%s\n"),
-			   rpmfiDN(fi), opath, rpmfiDN(fi), dest);
-		    free(opath);
-		}
-		free(*path);
-		*path = dest;
-	    } else
-		free(dest);
+	    if (fsmUringRename(u, dirfd, *path, dest, rpmfiFX(fi),
+				nsuffix != NULL) == 0) {
+		*queued = 1;
+	    } else {
+		rc = fsmRename(dirfd, *path, dirfd, dest);
+		rc = fsmCommitDone(fi, path, dest, nsuffix != NULL, rc);
+	    }
 	}
     }
 
@@ -837,14 +1241,17 @@ static void setFileState(rpmfs fs, int i)
 struct diriter_s {
     int dirfd;
     int firstdir;
+    fsmuring uring;
 };
 
 static int onChdir(rpmfi fi, void *data)
 {
     struct diriter_s *di = data;
+    /* Queued operations may refer to the directory */
+    int rc = fsmUringFlush(di->uring);
 
     fsmClose(&(di->dirfd));
-    return 0;
+    return rc;
 }
 
 static rpmfi fsmIter(FD_t payload, rpmfiles files, rpmFileIter iter, void *data)
@@ -882,7 +1289,8 @@ int rpmPackageFilesInstall(rpmts ts, rpmte te, rpmfiles files,
     char *tid = NULL;
     struct filedata_s *fdata = xcalloc(fc, sizeof(*fdata));
     struct filedata_s *firstlink = NULL;
-    struct diriter_s di = { -1, -1 };
+    struct diriter_s di = { -1, -1, NULL };
+    fsmuring uring = NULL;
 
     /* transaction id used for temporary path suffix while installing */
     rasprintf(&tid, ";%08x", (unsigned)rpmtsGetTid(ts));
@@ -925,6 +1333,8 @@ int rpmPackageFilesInstall(rpmts ts, rpmte te, rpmfiles files,
         goto exit;
     }
 
+    uring = fsmUringNew();
+
     /* Process the payload */
     while (!rc && (fx = rpmfiNext(fi)) >= 0) {
 	struct filedata_s *fp = &fdata[fx];
@@ -1036,7 +1446,7 @@ setmeta:
 	    }
 
 	    if (fd != firstlinkfile)
-		fsmClose(&fd);
+		fsmUringClose(uring, &fd);
 	}
 
 	/* Notify on success. */
@@ -1051,12 +1461,26 @@ setmeta:
     if (!rc && fx < 0 && fx != RPMERR_ITER_END)
 	rc = fx;
 
+    /* Files need to be closed before committing, at least for fsync */
+    fsmUringFlush(uring);
+
     /* If all went well, commit files to final destination */
+    fsmUringCommitBegin(uring, fdata, files, plugins, failedFile);
+    di.uring = uring;
     fi = fsmIter(NULL, files, RPMFI_ITER_FWD, &di);
     while (!rc && (fx = rpmfiNext(fi)) >= 0) {
 	struct filedata_s *fp = &fdata[fx];
 
 	if (!fp->skip) {
+	    int queued = 0;
+
+	    /*
+	     * Failed queued renames end the loop as synchronous ones do.
+	     * Backups touch more files, only do them once the queue is done.
+	     */
+	    if ((rc = fsmUringCheck(uring, fp->suffix != NULL)))
+		break;
+
 	    if (!rc)
 		rc = ensureDir(NULL, rpmfiDN(fi), 0, 0, 0, &di.dirfd);
 
@@ -1065,18 +1489,20 @@ setmeta:
 		rc = fsmBackup(di.dirfd, fi, fp->action);
 
 	    if (!rc)
-		rc = fsmCommit(di.dirfd, &fp->fpath, fi, fp->action, fp->suffix);
+		rc = fsmCommit(uring, di.dirfd, &fp->fpath, fi,
+			       fp->action, fp->suffix, &queued);
 
-	    if (!rc)
-		fp->stage = FILE_COMMIT;
-	    else
-		*failedFile = rstrscat(NULL, rpmfiDN(fi), fp->fpath, NULL);
-
-	    /* Run fsm file post hook for all plugins for all processed files */
-	    rpmpluginsCallFsmFilePost(plugins, fi, fp->fpath,
-				      fp->sb.st_mode, fp->action, rc);
+	    /* Queued renames are finished on completion */
+	    if (!queued)
+		fsmCommitPost(plugins, fi, fp, rc, failedFile);
 	}
     }
+
+    /* Finish queued renames, errors from them also end the loop early */
+    int urc = fsmUringFlush(uring);
+    if (!rc)
+	rc = urc;
+    di.uring = NULL;
     fi = fsmIterFini(fi, &di);
 
     /* On failure, walk backwards and erase non-committed files */
@@ -1100,6 +1526,7 @@ setmeta:
 
 exit:
     fi = fsmIterFini(fi, &di);
+    uring = fsmUringFree(uring);
     Fclose(payload);
     free(tid);
     for (int i = 0; i < fc; i++)
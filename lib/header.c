@@ -73,6 +73,7 @@ enum headerFlags_e {
     HEADERFLAG_ALLOCATED = (1 << 1), /*!< Is 1st header region allocated? */
     HEADERFLAG_LEGACY    = (1 << 2), /*!< Header came from legacy source? */
     HEADERFLAG_DEBUG     = (1 << 3), /*!< Debug this header? */
+    HEADERFLAG_KEEP      = (1 << 4), /*!< Keep exported region for reuse? */
 };
 
 typedef rpmFlags headerFlags;
@@ -98,6 +99,20 @@ struct indexEntry_s {
     uint32_t rdlen;		/*!< No. bytes of data in region. */
 };
 
+/** \ingroup header
+ * Chunk of bump-allocated memory released with the header.
+ */
+typedef struct hdrArena_s * hdrArena;
+struct hdrArena_s {
+    hdrArena next;		/*!< Previously filled chunks */
+    size_t size;		/*!< Usable size of data */
+    size_t used;		/*!< Bytes handed out from data */
+    uint64_t data[];		/*!< Chunk memory, aligned for any tag type */
+};
+
+#define	ARENA_CHUNK_SIZE	(16 * 1024)
+#define	ARENA_MAX_SIZE		(256 * 1024)	/* per header, malloc beyond */
+
 /** \ingroup header
  * The Header data structure.
  */
@@ -110,6 +125,13 @@ struct headerToken_s {
     headerFlags flags;
     int sorted;			/*!< Current sort method */
     int nrefs;			/*!< Reference count. */
+    hdrblob lazy;		/*!< Blob of lazily imported entries */
+    uint16_t *tagmap;		/*!< Direct-mapped index of common tags */
+    hdrArena arena;		/*!< Memory for HEADERGET_ARENA retrievals */
+    size_t arenasize;		/*!< Total size of arena chunks */
+    void *xblob;		/*!< Exported region index + data, net order */
+    uint32_t xil;		/*!< No. of index entries in xblob */
+    uint32_t xdl;		/*!< No. of data bytes in xblob */
 };
 
 /** \ingroup header
@@ -122,6 +144,19 @@ static const size_t headerMaxbytes = (256*1024*1024);
 #define	ENTRY_IS_REGION(_e) \
 	(((_e)->info.tag >= RPMTAG_HEADERIMAGE) && ((_e)->info.tag < RPMTAG_HEADERREGIONS))
 #define	ENTRY_IN_REGION(_e)	((_e)->info.offset < 0)
+/*
+ * Most lookups are for tags in the base and file/dependency ranges,
+ * those get mapped straight to (1 + last) index of the tag when sorted.
+ */
+#define	TAGMAP_LO	RPMTAG_NAME
+#define	TAGMAP_LOSIZE	200
+#define	TAGMAP_HI	RPMTAG_FILENAMES
+#define	TAGMAP_HISIZE	128
+#define	TAGMAP_SIZE	(TAGMAP_LOSIZE + TAGMAP_HISIZE)
+
+/* Lazily imported entries carry their blob index in rdlen until decoded */
+#define	ENTRY_IS_LAZY(_h, _e) \
+	((_h)->lazy && (_e)->rdlen && !ENTRY_IS_REGION(_e))
 
 #define	REGION_TAG_TYPE		RPM_BIN_TYPE
 #define	REGION_TAG_COUNT	sizeof(struct entryInfo_s)
@@ -190,11 +225,14 @@ static int dataLength(uint32_t type, const void * p, uint32_t count,
 void hdrblobDigestUpdate(rpmDigestBundle bundle, struct hdrblob_s *blob)
 {
     uint32_t ildl[2] = { htonl(blob->ril), htonl(blob->rdl) };
-
-    rpmDigestBundleUpdate(bundle, rpm_header_magic, sizeof(rpm_header_magic));
-    rpmDigestBundleUpdate(bundle, ildl, sizeof(ildl));
-    rpmDigestBundleUpdate(bundle, blob->pe, (blob->ril * sizeof(*blob->pe)));
-    rpmDigestBundleUpdate(bundle, blob->dataStart, blob->rdl);
+    struct iovec iov[] = {
+	{ (void *)rpm_header_magic, sizeof(rpm_header_magic) },
+	{ ildl, sizeof(ildl) },
+	{ blob->pe, (blob->ril * sizeof(*blob->pe)) },
+	{ blob->dataStart, blob->rdl },
+    };
+
+    rpmDigestBundleUpdateV(bundle, iov, sizeof(iov) / sizeof(iov[0]));
 }
 
 /* Check tag type matches our definition */
@@ -271,6 +309,14 @@ Header headerFree(Header h)
 	h->index = _free(h->index);
     }
     h->blob = _free(h->blob);
+    h->lazy = _free(h->lazy);
+    h->tagmap = _free(h->tagmap);
+    h->xblob = _free(h->xblob);
+    while (h->arena) {
+	hdrArena next = h->arena->next;
+	free(h->arena);
+	h->arena = next;
+    }
 
     h = _free(h);
     return NULL;
@@ -300,57 +346,72 @@ Header headerNew(void)
     return headerCreate(NULL, 0);
 }
 
-static rpmRC hdrblobVerifyInfo(hdrblob blob, char **emsg)
+/* Sanity check a single entry, returning its data length in *lenp */
+static int hdrblobVerifyEntry(hdrblob blob, entryInfo pe,
+			      struct entryInfo_s *info, uint32_t *lenp)
 {
-    struct entryInfo_s info;
-    uint32_t i, len = 0;
-    uint32_t end = 0;
     const char *ds = (const char *) blob->dataStart;
-    uint32_t il = (blob->regionTag) ? blob->il-1 : blob->il;
-    entryInfo pe = (blob->regionTag) ? blob->pe+1 : blob->pe;
+    uint32_t len = 0;
+    uint32_t end;
     /* Can't typecheck signature header tags, sigh */
     int typechk = (blob->regionTag == RPMTAG_HEADERIMMUTABLE ||
 		   blob->regionTag == RPMTAG_HEADERIMAGE);
 
-    for (i = 0; i < il; i++) {
-	ei2h(&pe[i], &info);
+    ei2h(pe, info);
+    *lenp = 0;
 
-	/* Previous data must not overlap */
-	if (end > info.offset)
-	    goto err;
+    if (hdrchkTag(info->tag))
+	return -1;
+    if (hdrchkType(info->type))
+	return -1;
+    if (hdrchkCount(blob->dl, info->count))
+	return -1;
+    if (hdrchkAlign(info->type, info->offset))
+	return -1;
+    if (hdrchkRange(blob->dl, info->offset))
+	return -1;
+    if (hdrchkArray(info->type, info->count))
+	return -1;
+    if (typechk && hdrchkTagType(info->tag, info->type))
+	return -1;
 
-	if (hdrchkTag(info.tag))
-	    goto err;
-	if (hdrchkType(info.type))
-	    goto err;
-	if (hdrchkCount(blob->dl, info.count))
-	    goto err;
-	if (hdrchkAlign(info.type, info.offset))
-	    goto err;
-	if (hdrchkRange(blob->dl, info.offset))
-	    goto err;
-	if (hdrchkArray(info.type, info.count))
-	    goto err;
-	if (typechk && hdrchkTagType(info.tag, info.type))
+    /* Verify the data actually fits */
+    if (dataLength(info->type, ds + info->offset,
+		     info->count, 1, ds + blob->dl, &len)) {
+	return -1;
+    }
+    *lenp = len;
+    end = info->offset + len;
+    if (hdrchkRange(blob->dl, end) || len <= 0)
+	return -1;
+    if (blob->regionTag) {
+	/*
+	 * Verify that the data does not overlap the region trailer.  The
+	 * region trailer is skipped by the callers, so the other checks
+	 * don’t catch this case.
+	 */
+	if (end > blob->rdl - REGION_TAG_COUNT && info->offset < blob->rdl)
+	    return -1;
+    }
+    return 0;
+}
+
+static rpmRC hdrblobVerifyRange(hdrblob blob, uint32_t first, uint32_t il,
+				uint32_t end, char **emsg)
+{
+    struct entryInfo_s info;
+    uint32_t i, len = 0;
+    entryInfo pe = blob->pe + first;
+
+    memset(&info, 0, sizeof(info));
+    for (i = 0; i < il; i++) {
+	if (hdrblobVerifyEntry(blob, &pe[i], &info, &len))
 	    goto err;
 
-	/* Verify the data actually fits */
-	if (dataLength(info.type, ds + info.offset,
-			 info.count, 1, ds + blob->dl, &len)) {
+	/* Previous data must not overlap */
+	if (end > info.offset)
 	    goto err;
-	}
 	end = info.offset + len;
-	if (hdrchkRange(blob->dl, end) || len <= 0)
-	    goto err;
-	if (blob->regionTag) {
-	    /*
-	     * Verify that the data does not overlap the region trailer.  The
-	     * region trailer is skipped by this loop, so the other checks
-	     * don’t catch this case.
-	     */
-	    if (end > blob->rdl - REGION_TAG_COUNT && info.offset < blob->rdl)
-		goto err;
-	}
     }
     return 0; /* Everything ok */
 
@@ -363,17 +424,52 @@ err:
     return i + 1;
 }
 
+static rpmRC hdrblobVerifyInfo(hdrblob blob, char **emsg)
+{
+    uint32_t first = (blob->regionTag) ? 1 : 0;
+    return hdrblobVerifyRange(blob, first, blob->il - first, 0, emsg);
+}
+
 static int indexCmp(const void * avp, const void * bvp)
 {
     indexEntry ap = (indexEntry) avp, bp = (indexEntry) bvp;
     return (ap->info.tag - bp->info.tag);
 }
 
+static inline int tagmapSlot(rpmTagVal tag)
+{
+    if (tag >= TAGMAP_LO && tag < TAGMAP_LO + TAGMAP_LOSIZE)
+	return tag - TAGMAP_LO;
+    if (tag >= TAGMAP_HI && tag < TAGMAP_HI + TAGMAP_HISIZE)
+	return TAGMAP_LOSIZE + tag - TAGMAP_HI;
+    return -1;
+}
+
+/* (Re)build the tag map of a sorted header, huge ones only use bsearch */
+static void headerMapTags(Header h)
+{
+    if (h->indexUsed >= UINT16_MAX) {
+	h->tagmap = _free(h->tagmap);
+	return;
+    }
+
+    if (h->tagmap == NULL)
+	h->tagmap = xmalloc(TAGMAP_SIZE * sizeof(*h->tagmap));
+    memset(h->tagmap, 0, TAGMAP_SIZE * sizeof(*h->tagmap));
+
+    for (int i = 0; i < h->indexUsed; i++) {
+	int slot = tagmapSlot(h->index[i].info.tag);
+	if (slot >= 0)
+	    h->tagmap[slot] = i + 1;
+    }
+}
+
 static void headerSort(Header h)
 {
     if (!h->sorted) {
 	qsort(h->index, h->indexUsed, sizeof(*h->index), indexCmp);
 	h->sorted = 1;
+	headerMapTags(h);
     }
 }
 
@@ -637,9 +733,175 @@ static int regionSwab(indexEntry entry, uint32_t il, uint32_t dl,
     return 0;
 }
 
-static void * doExport(const struct indexEntry_s *hindex, int indexUsed,
-			headerFlags flags, unsigned int *bsize)
+/*
+ * Fill in region entries for decoding on first access, only checking
+ * what sorting and lookups depend on. Offsets must ascend for the
+ * per-entry overlap checks in entryDecode() to cover the whole region.
+ */
+static int lazyIndex(indexEntry entry, hdrblob blob, uint32_t first,
+		     uint32_t il, int regionid)
+{
+    int32_t prev = -1;
+
+    for (uint32_t i = first; i < first + il; i++, entry++) {
+	ei2h(&blob->pe[i], &entry->info);
+
+	if (hdrchkTag(entry->info.tag))
+	    return -1;
+	if (entry->info.offset <= prev ||
+	    hdrchkRange(blob->dl, entry->info.offset))
+	    return -1;
+	prev = entry->info.offset;
+
+	entry->data = blob->dataStart + entry->info.offset;
+	entry->length = 0;
+	entry->rdlen = i;	/* never 0, the region tag is at index 0 */
+	entry->info.offset = regionid;
+    }
+    return 0;
+}
+
+/*
+ * Validate and byte-swap a lazily imported entry on first use. Entries
+ * failing the checks eager import would have done are dropped from view.
+ */
+static int entryDecode(Header h, indexEntry entry)
+{
+    hdrblob blob = h->lazy;
+    struct entryInfo_s info;
+    entryInfo pe;
+    uint32_t ix, len;
+
+    if (!ENTRY_IS_LAZY(h, entry))
+	return 0;
+    if (entry->data == NULL)
+	return -1;
+
+    ix = entry->rdlen;
+    pe = blob->pe + ix;
+    if (hdrblobVerifyEntry(blob, pe, &info, &len))
+	goto err;
+
+    /* Data must not overlap that of the next entry in the region */
+    if (ix + 1 < blob->ril && info.offset + len > ntohl(pe[1].offset))
+	goto err;
+
+    if (typeSizes[info.type] > 1 &&
+	regionSwab(NULL, 1, 0, pe, blob->dataStart, blob->dataEnd, 0, 0, NULL))
+	goto err;
+
+    entry->length = len;
+    entry->rdlen = 0;
+    return 0;
+
+err:
+    entry->data = NULL;
+    return -1;
+}
+
+static int headerDecodeAll(Header h)
+{
+    int rc = 0;
+
+    if (h->lazy) {
+	for (int i = 0; i < h->indexUsed; i++) {
+	    if (entryDecode(h, h->index + i))
+		rc = -1;
+	}
+    }
+    return rc;
+}
+
+/* Copy a non-region entry into an export blob, returns new data end */
+static char * exportEntry(const struct indexEntry_s *entry, entryInfo pe,
+			  char *dataStart, char *te)
+{
+    const char * src;
+    uint32_t count;
+    unsigned int diff;
+
+    pe->tag = htonl(entry->info.tag);
+    pe->type = htonl(entry->info.type);
+    pe->count = htonl(entry->info.count);
+
+    /* Alignment */
+    diff = alignDiff(entry->info.type, (te - dataStart));
+    if (diff) {
+	memset(te, 0, diff);
+	te += diff;
+    }
+
+    pe->offset = htonl(te - dataStart);
+
+    /* copy data w/ endian conversions */
+    switch (entry->info.type) {
+    case RPM_INT64_TYPE:
+	count = entry->info.count;
+	src = entry->data;
+	while (count--) {
+	    *((uint64_t *)te) = htonll(*((uint64_t *)src));
+	    te += sizeof(uint64_t);
+	    src += sizeof(uint64_t);
+	}
+	break;
+
+    case RPM_INT32_TYPE:
+	count = entry->info.count;
+	src = entry->data;
+	while (count--) {
+	    *((uint32_t *)te) = htonl(*((uint32_t *)src));
+	    te += sizeof(uint32_t);
+	    src += sizeof(uint32_t);
+	}
+	break;
+
+    case RPM_INT16_TYPE:
+	count = entry->info.count;
+	src = entry->data;
+	while (count--) {
+	    *((uint16_t *)te) = htons(*((uint16_t *)src));
+	    te += sizeof(uint16_t);
+	    src += sizeof(uint16_t);
+	}
+	break;
+
+    default:
+	memcpy(te, entry->data, entry->length);
+	te += entry->length;
+	break;
+    }
+    return te;
+}
+
+/* Regions never change, remember their exported form for next time */
+static void exportKeep(Header h, const uint32_t *ei, uint32_t il, uint32_t dl)
+{
+    uint32_t ilen = il * sizeof(struct entryInfo_s);
+
+    h->xblob = _free(h->xblob);
+    if (il == 0)
+	return;
+
+    h->xblob = xmalloc(ilen + dl);
+    h->xil = il;
+    h->xdl = dl;
+    memcpy(h->xblob, ei + 2, ilen);
+    memcpy((char *)h->xblob + ilen, (char *)(ei + 2) + ntohl(ei[0]) * sizeof(struct entryInfo_s), dl);
+}
+
+/* Drop the kept region export if a change to entry could affect it */
+static void exportDirty(Header h, indexEntry entry)
 {
+    if (h->xblob && ENTRY_IN_REGION(entry))
+	h->xblob = _free(h->xblob);
+}
+
+static void * doExport(Header h, unsigned int *bsize)
+{
+    const struct indexEntry_s *hindex = h->index;
+    int indexUsed = h->indexUsed;
+    headerFlags flags = h->flags;
+    uint32_t xil = 0, xdl = 0;
     uint32_t * ei = NULL;
     entryInfo pe;
     char * dataStart;
@@ -721,7 +983,6 @@ static void * doExport(const struct indexEntry_s *hindex, int indexUsed,
 	unsigned char *t;
 	uint32_t count;
 	uint32_t rdlen;
-	unsigned int diff;
 
 	if (entry->data == NULL || entry->length <= 0)
 	    continue;
@@ -788,59 +1049,13 @@ static void * doExport(const struct indexEntry_s *hindex, int indexUsed,
 	    i--;
 	    entry--;
 	    pe += ril;
+	    /* Regions sort first, everything up to here can be kept */
+	    xil = pe - (entryInfo) &ei[2];
+	    xdl = te - dataStart;
 	    continue;
 	}
 
-	/* Ignore deleted drips. */
-	if (entry->data == NULL || entry->length <= 0)
-	    continue;
-
-	/* Alignment */
-	diff = alignDiff(entry->info.type, (te - dataStart));
-	if (diff) {
-	    memset(te, 0, diff);
-	    te += diff;
-	}
-
-	pe->offset = htonl(te - dataStart);
-
-	/* copy data w/ endian conversions */
-	switch (entry->info.type) {
-	case RPM_INT64_TYPE:
-	    count = entry->info.count;
-	    src = entry->data;
-	    while (count--) {
-		*((uint64_t *)te) = htonll(*((uint64_t *)src));
-		te += sizeof(uint64_t);
-		src += sizeof(uint64_t);
-	    }
-	    break;
-
-	case RPM_INT32_TYPE:
-	    count = entry->info.count;
-	    src = entry->data;
-	    while (count--) {
-		*((uint32_t *)te) = htonl(*((uint32_t *)src));
-		te += sizeof(uint32_t);
-		src += sizeof(uint32_t);
-	    }
-	    break;
-
-	case RPM_INT16_TYPE:
-	    count = entry->info.count;
-	    src = entry->data;
-	    while (count--) {
-		*((uint16_t *)te) = htons(*((uint16_t *)src));
-		te += sizeof(uint16_t);
-		src += sizeof(uint16_t);
-	    }
-	    break;
-
-	default:
-	    memcpy(te, entry->data, entry->length);
-	    te += entry->length;
-	    break;
-	}
+	te = exportEntry(entry, pe, dataStart, te);
 	pe++;
     }
    
@@ -853,6 +1068,8 @@ static void * doExport(const struct indexEntry_s *hindex, int indexUsed,
     if (bsize)
 	*bsize = len;
 
+    if (flags & HEADERFLAG_KEEP)
+	exportKeep(h, ei, xil, xdl);
     free(index);
     return (void *) ei;
 
@@ -862,59 +1079,152 @@ errxit:
     return NULL;
 }
 
+/* Export a header reusing the kept region, only added entries are copied */
+static void * doExportKept(Header h, unsigned int *bsize)
+{
+    uint32_t il = h->xil;
+    uint32_t dl = h->xdl;
+    uint32_t ilen = il * sizeof(struct entryInfo_s);
+    indexEntry index, entry;
+    uint32_t * ei;
+    entryInfo pe;
+    char * dataStart;
+    char * te;
+    unsigned len;
+    int n = 0;
+
+    /* Entries outside regions, in tag order as by offsetCmp() */
+    headerSort(h);
+    index = xmalloc(h->indexUsed * sizeof(*index));
+    for (int i = 0; i < h->indexUsed; i++) {
+	entry = h->index + i;
+	if (ENTRY_IN_REGION(entry) || entry->data == NULL || entry->length <= 0)
+	    continue;
+	dl += alignDiff(entry->info.type, dl);
+	dl += entry->length;
+	index[n++] = *entry;	/* structure assignment */
+    }
+    il += n;
+
+    if (hdrchkTags(il) || hdrchkData(dl)) {
+	free(index);
+	return NULL;
+    }
+
+    len = sizeof(il) + sizeof(dl) + (il * sizeof(*pe)) + dl;
+    ei = xmalloc(len);
+    ei[0] = htonl(il);
+    ei[1] = htonl(dl);
+
+    pe = (entryInfo) &ei[2];
+    dataStart = (char *) (pe + il);
+    memcpy(pe, h->xblob, ilen);
+    memcpy(dataStart, (char *)h->xblob + ilen, h->xdl);
+    pe += h->xil;
+    te = dataStart + h->xdl;
+
+    for (int i = 0; i < n; i++, pe++)
+	te = exportEntry(&index[i], pe, dataStart, te);
+    free(index);
+
+    if (bsize)
+	*bsize = len;
+    return (void *) ei;
+}
+
 void * headerExport(Header h, unsigned int *bsize)
 {
     void *blob = NULL;
 
-    if (h) {
-	blob = doExport(h->index, h->indexUsed, h->flags, bsize);
+    if (h && h->xblob) {
+	blob = doExportKept(h, bsize);
+    } else if (h && headerDecodeAll(h) == 0) {
+	blob = doExport(h, bsize);
     }
 
     return blob;
 }
 
 /**
- * Find matching (tag,type) entry in header.
+ * Find the last index entry of a tag, lazy entries are not decoded.
  * @param h		header
  * @param tag		entry tag
- * @param type		entry type
- * @return 		header entry
+ * @return		header entry
  */
-static
-indexEntry findEntry(Header h, rpmTagVal tag, uint32_t type)
+static indexEntry findTag(Header h, rpmTagVal tag)
 {
-    indexEntry entry;
+    indexEntry entry, last;
     struct indexEntry_s key;
+    int slot = tagmapSlot(tag);
 
-    if (h == NULL) return NULL;
     headerSort(h);
 
-    key.info.tag = tag;
+    if (slot >= 0 && h->tagmap) {
+	if (h->tagmap[slot] == 0)
+	    return NULL;
+	return h->index + h->tagmap[slot] - 1;
+    }
 
-    entry = bsearch(&key, h->index, h->indexUsed, sizeof(*h->index), indexCmp);
+    key.info.tag = tag;
+    entry = bsearch(&key, h->index, h->indexUsed, sizeof(*h->index),
+		    indexCmp);
     if (entry == NULL)
 	return NULL;
 
-    if (type == RPM_NULL_TYPE)
-	return entry;
+    last = h->index + h->indexUsed - 1;
+    while (entry < last && (entry + 1)->info.tag == tag)
+	entry++;
+    return entry;
+}
+
+/**
+ * Find matching (tag,type) entry in header.
+ * @param h		header
+ * @param tag		entry tag
+ * @param type		entry type
+ * @return 		header entry
+ */
+static
+indexEntry findEntry(Header h, rpmTagVal tag, uint32_t type)
+{
+    indexEntry entry;
 
-    /* look backwards */
-    while (entry->info.tag == tag && entry->info.type != type &&
-	   entry > h->index) entry--;
+    if (h == NULL) return NULL;
 
-    if (entry->info.tag == tag && entry->info.type == type)
-	return entry;
+    /* look backwards, skipping entries which fail to decode */
+    for (entry = findTag(h, tag); entry && entry->info.tag == tag; entry--) {
+	if ((type == RPM_NULL_TYPE || entry->info.type == type) &&
+	    entryDecode(h, entry) == 0)
+	    return entry;
+	if (entry == h->index)
+	    break;
+    }
 
     return NULL;
 }
 
+/* Decode all entries of a tag, -1 if any of them fails */
+static int tagDecode(Header h, rpmTagVal tag)
+{
+    indexEntry entry;
+
+    for (entry = findTag(h, tag); entry && entry->info.tag == tag; entry--) {
+	if (entryDecode(h, entry))
+	    return -1;
+	if (entry == h->index)
+	    break;
+    }
+    return 0;
+}
+
 int headerDel(Header h, rpmTagVal tag)
 {
     indexEntry last = h->index + h->indexUsed;
     indexEntry entry, first;
     int ne;
 
-    entry = findEntry(h, tag, RPM_NULL_TYPE);
+    /* Entries failing to decode go too, they must not linger beside new */
+    entry = findTag(h, tag);
     if (!entry) return 1;
 
     /* Make sure entry points to the first occurrence of this tag. */
@@ -926,6 +1236,7 @@ int headerDel(Header h, rpmTagVal tag)
 	void * data;
 	if (first->info.tag != tag)
 	    break;
+	exportDirty(h, first);
 	data = first->data;
 	first->data = NULL;
 	first->length = 0;
@@ -940,19 +1251,43 @@ int headerDel(Header h, rpmTagVal tag)
 	ne = last - first;
 	if (ne > 0)
 	    memmove(entry, first, (ne * sizeof(*entry)));
+	if (h->sorted)
+	    headerMapTags(h);
     }
 
     return 0;
 }
 
-rpmRC hdrblobImport(hdrblob blob, int fast, Header *hdrp, char **emsg)
+rpmRC hdrblobImport(hdrblob blob, headerImportFlags flags, Header *hdrp,
+		    char **emsg)
 {
     Header h = NULL;
     indexEntry entry; 
     uint32_t rdlen;
+    int fast = (flags & HEADERIMPORT_FAST);
+    int lazy = (flags & HEADERIMPORT_LAZY);
+    void *xblob = NULL;
+
+    /* Only region entries can be decoded lazily, verify anything else now */
+    if (lazy && !blob->regionTag && hdrblobVerifyInfo(blob, emsg))
+	return RPMRC_FAIL;
 
     h = headerCreate(blob->ei, blob->il);
 
+    /*
+     * Only keep exports on request, they double the memory use. Region
+     * headers export back to what they were imported from: copy the blob
+     * before decoding swaps it, replacing dribbles mustn't drop it.
+     */
+    if (flags & HEADERIMPORT_KEEP) {
+	h->flags |= HEADERFLAG_KEEP;
+	if (!lazy && blob->regionTag) {
+	    exportKeep(h, blob->ei, blob->il, blob->dl);
+	    xblob = h->xblob;
+	    h->xblob = NULL;
+	}
+    }
+
     entry = h->index;
     if (!(htonl(blob->pe->tag) < RPMTAG_HEADERI18NTABLE)) {
 	/* An original v3 header, create a legacy region entry for it */
@@ -987,7 +1322,17 @@ rpmRC hdrblobImport(hdrblob blob, int fast, Header *hdrp, char **emsg)
 	entry->info.offset = -offset; /* negative offset */
 	entry->data = blob->pe;
 	entry->length = blob->pvlen - sizeof(blob->il) - sizeof(blob->dl);
-	if (regionSwab(entry+1, ril-1, 0, blob->pe+1,
+	if (lazy && blob->regionTag) {
+	    /* Region entries are decoded on first access, dribbles now */
+	    if (lazyIndex(entry+1, blob, 1, ril-1, entry->info.offset))
+		goto errxit;
+	    /* Dribble data must follow the region data, trailer included */
+	    if (hdrblobVerifyRange(blob, ril, blob->il - ril, blob->rdl, emsg))
+		goto errxit;
+	    rdlen = blob->rdl - REGION_TAG_COUNT;
+	    h->lazy = memcpy(xmalloc(sizeof(*blob)), blob, sizeof(*blob));
+	    h->lazy->ei = NULL;
+	} else if (regionSwab(entry+1, ril-1, 0, blob->pe+1,
 			   blob->dataStart, blob->dataEnd,
 			   entry->info.offset, fast, &rdlen)) {
 	    goto errxit;
@@ -1012,6 +1357,11 @@ rpmRC hdrblobImport(hdrblob blob, int fast, Header *hdrp, char **emsg)
 	    /* Dribble entries replace duplicate region entries. */
 	    h->indexUsed -= ne;
 	    for (j = 0; j < ne; j++, newEntry++) {
+		/* Reject corrupt replaced entries as eager import does */
+		if (h->lazy && (tagDecode(h, newEntry->info.tag) ||
+		    (newEntry->info.tag == RPMTAG_BASENAMES &&
+		     tagDecode(h, RPMTAG_OLDFILENAMES))))
+		    goto errxit;
 		(void) headerDel(h, newEntry->info.tag);
 		if (newEntry->info.tag == RPMTAG_BASENAMES)
 		    (void) headerDel(h, RPMTAG_OLDFILENAMES);
@@ -1036,6 +1386,8 @@ rpmRC hdrblobImport(hdrblob blob, int fast, Header *hdrp, char **emsg)
     h->sorted = 0;
     headerSort(h);
     h->flags |= HEADERFLAG_ALLOCATED;
+    /* The region and dribbles were checked to fill the blob exactly */
+    h->xblob = xblob;
     *hdrp = h;
 
     /* We own the memory now, avoid double-frees */
@@ -1046,8 +1398,13 @@ rpmRC hdrblobImport(hdrblob blob, int fast, Header *hdrp, char **emsg)
 errxit:
     if (h) {
 	free(h->index);
+	free(h->lazy);
+	free(h->tagmap);
+	free(h->xblob);
 	free(h);
-	rasprintf(emsg, _("hdr load: BAD"));
+	free(xblob);
+	if (emsg && *emsg == NULL)
+	    rasprintf(emsg, _("hdr load: BAD"));
     }
     return RPMRC_FAIL;
 }
@@ -1138,7 +1495,56 @@ int headerIsSourceHeuristic(Header h)
  * @param flags		flags to control memory allocation
  * @return		1 on success, otherwise error.
  */
-static int copyTdEntry(const indexEntry entry, rpmtd td, headerGetFlags flags)
+static void * arenaAlloc(Header h, size_t size)
+{
+    hdrArena a = h->arena;
+    void * p;
+
+    size = (size + sizeof(*a->data) - 1) & ~(sizeof(*a->data) - 1);
+    if (a == NULL || a->size - a->used < size) {
+	/* Big allocations get a chunk of their own behind the current one */
+	int own = (size > ARENA_CHUNK_SIZE / 4);
+	size_t csize = own ? size : ARENA_CHUNK_SIZE;
+	hdrArena n;
+
+	/* Long-lived headers get repeated retrievals, don't grow forever */
+	if (h->arenasize + csize > ARENA_MAX_SIZE)
+	    return NULL;
+	n = xmalloc(sizeof(*n) + csize);
+	h->arenasize += csize;
+
+	n->size = csize;
+	n->used = 0;
+	if (own && a) {
+	    n->next = a->next;
+	    a->next = n;
+	} else {
+	    n->next = a;
+	    h->arena = n;
+	}
+	a = n;
+    }
+    p = (char *) a->data + a->used;
+    a->used += size;
+    return p;
+}
+
+/*
+ * Allocate tag data from the header arena if requested, malloc otherwise.
+ * Clears *arena when the arena is full and the caller must free the data.
+ */
+static inline void * tdAlloc(Header h, int *arena, size_t size)
+{
+    void * p = *arena ? arenaAlloc(h, size) : NULL;
+    if (p == NULL) {
+	*arena = 0;
+	p = xmalloc(size);
+    }
+    return p;
+}
+
+static int copyTdEntry(Header h, const indexEntry entry, rpmtd td,
+			headerGetFlags flags)
 {
     uint32_t count = entry->info.count;
     int rc = 1;		/* XXX 1 on success. */
@@ -1146,6 +1552,9 @@ static int copyTdEntry(const indexEntry entry, rpmtd td, headerGetFlags flags)
     int allocMem = flags & HEADERGET_ALLOC;
     int minMem = allocMem ? 0 : flags & HEADERGET_MINMEM;
     int argvArray = (flags & HEADERGET_ARGV) ? 1 : 0;
+    int arena = (h != NULL && (flags & HEADERGET_ARENA));
+    int packed = (h != NULL && minMem && !argvArray &&
+		  (flags & HEADERGET_PACKED));
 
     assert(td != NULL);
     td->flags = RPMTD_IMMUTABLE;
@@ -1174,7 +1583,7 @@ static int copyTdEntry(const indexEntry entry, rpmtd td, headerGetFlags flags)
 		rdl += REGION_TAG_COUNT;
 	    }
 
-	    td->data = xmalloc(count);
+	    td->data = tdAlloc(h, &arena, count);
 	    ei = (uint32_t *) td->data;
 	    ei[0] = htonl(ril);
 	    ei[1] = htonl(rdl);
@@ -1187,20 +1596,27 @@ static int copyTdEntry(const indexEntry entry, rpmtd td, headerGetFlags flags)
 			    0, 0, NULL);
 	    /* don't return data on failure */
 	    if (rc < 0) {
-		td->data = _free(td->data);
+		if (!arena)
+		    free(td->data);
+		td->data = NULL;
 	    }
 	    /* XXX 1 on success. */
 	    rc = (rc < 0) ? 0 : 1;
 	} else {
 	    td->data = (!minMem
-		? memcpy(xmalloc(count), entry->data, count)
+		? memcpy(tdAlloc(h, &arena, count), entry->data, count)
 		: entry->data);
 	}
 	break;
     case RPM_STRING_TYPE:
 	/* simple string, but fallthrough if its actually an array */
 	if (count == 1 && !argvArray) {
-	    td->data = allocMem ? xstrdup(entry->data) : entry->data;
+	    if (allocMem) {
+		size_t len = strlen(entry->data) + 1;
+		td->data = memcpy(tdAlloc(h, &arena, len), entry->data, len);
+	    } else {
+		td->data = entry->data;
+	    }
 	    break;
 	}
     case RPM_STRING_ARRAY_TYPE:
@@ -1210,12 +1626,24 @@ static int copyTdEntry(const indexEntry entry, rpmtd td, headerGetFlags flags)
 	char * t;
 	int i;
 
-	if (minMem) {
-	    td->data = xmalloc(tableSize);
+	if (packed) {
+	    /* Just a cursor into the header, freed along with it if there's room */
+	    rpmtdPacked p = arenaAlloc(h, sizeof(*p));
+	    if (p == NULL) {
+		p = xmalloc(sizeof(*p));
+		arena = packed = 0;
+	    }
+	    p->base = p->str = entry->data;
+	    p->ix = 0;
+	    td->data = p;
+	    td->flags |= RPMTD_PACKED;
+	    break;
+	} else if (minMem) {
+	    td->data = tdAlloc(h, &arena, tableSize);
 	    ptrEntry = (const char **) td->data;
 	    t = entry->data;
 	} else {
-	    t = xmalloc(tableSize + entry->length);
+	    t = tdAlloc(h, &arena, tableSize + entry->length);
 	    td->data = (void *)t;
 	    ptrEntry = (const char **) td->data;
 	    t += tableSize;
@@ -1237,7 +1665,7 @@ static int copyTdEntry(const indexEntry entry, rpmtd td, headerGetFlags flags)
     case RPM_INT32_TYPE:
     case RPM_INT64_TYPE:
 	if (allocMem) {
-	    td->data = xmalloc(entry->length);
+	    td->data = tdAlloc(h, &arena, entry->length);
 	    memcpy(td->data, entry->data, entry->length);
 	} else {
 	    td->data = entry->data;
@@ -1253,7 +1681,8 @@ static int copyTdEntry(const indexEntry entry, rpmtd td, headerGetFlags flags)
     td->count = count;
     td->size = entry->length;
 
-    if (td->data && entry->data != td->data) {
+    /* Arena memory belongs to the header */
+    if (td->data && entry->data != td->data && !arena && !packed) {
 	td->flags |= RPMTD_ALLOCED;
     }
 
@@ -1369,8 +1798,11 @@ static int copyI18NEntry(Header h, indexEntry entry, rpmtd td,
 
 exit:
     if (flags & HEADERGET_ALLOC) {
-	td->data = xstrdup(td->data);
-	td->flags |= RPMTD_ALLOCED;
+	int arena = (flags & HEADERGET_ARENA);
+	size_t len = strlen(td->data) + 1;
+	td->data = memcpy(tdAlloc(h, &arena, len), td->data, len);
+	if (!arena)
+	    td->flags |= RPMTD_ALLOCED;
     }
 
     return 1;
@@ -1399,7 +1831,7 @@ static int intGetTdEntry(Header h, rpmtd td, headerGetFlags flags)
     if (entry->info.type == RPM_I18NSTRING_TYPE && !(flags & HEADERGET_RAW))
 	rc = copyI18NEntry(h, entry, td, flags);
     else
-	rc = copyTdEntry(entry, td, flags);
+	rc = copyTdEntry(h, entry, td, flags);
 
     if (rc == 0)
 	td->flags |= RPMTD_INVALID;
@@ -1517,11 +1949,21 @@ static int intAddEntry(Header h, rpmtd td)
     entry->info.offset = 0;
     entry->data = data;
     entry->length = length;
+    entry->rdlen = 0;	/* not lazy */
 
     if (h->indexUsed > 0 && td->tag < h->index[h->indexUsed-1].info.tag)
 	h->sorted = 0;
     h->indexUsed++;
 
+    /* Appending in order keeps the header sorted, keep the map in sync */
+    if (h->sorted && h->tagmap) {
+	int slot = tagmapSlot(td->tag);
+	if (h->indexUsed >= UINT16_MAX)
+	    h->tagmap = _free(h->tagmap);
+	else if (slot >= 0)
+	    h->tagmap[slot] = h->indexUsed;
+    }
+
     return 1;
 }
 
@@ -1543,6 +1985,7 @@ static int intAppendEntry(Header h, rpmtd td)
     if (dataLength(td->type, td->data, td->count, 0, NULL, &length))
 	return 0;
 
+    exportDirty(h, entry);
     if (ENTRY_IN_REGION(entry)) {
 	char * t = xmalloc(entry->length + length);
 	memcpy(t, entry->data, entry->length);
@@ -1626,6 +2069,7 @@ int headerAddI18NString(Header h, rpmTagVal tag, const char * string,
 
     if (langNum >= table->info.count) {
 	length = strlen(lang) + 1;
+	exportDirty(h, table);
 	if (ENTRY_IN_REGION(table)) {
 	    char * t = xmalloc(table->length + length);
 	    memcpy(t, table->data, table->length);
@@ -1656,6 +2100,7 @@ int headerAddI18NString(Header h, rpmTagVal tag, const char * string,
 	return rc;
     } else if (langNum >= entry->info.count) {
 	ghosts = langNum - entry->info.count;
+	exportDirty(h, entry);
 	
 	length = strlen(string) + 1 + ghosts;
 	if (ENTRY_IN_REGION(entry)) {
@@ -1701,6 +2146,7 @@ int headerAddI18NString(Header h, rpmTagVal tag, const char * string,
 	t += en;
 
 	/* Replace i18N string array */
+	exportDirty(h, entry);
 	entry->length -= strlen(be) + 1;
 	entry->length += sn;
 	
@@ -1737,6 +2183,7 @@ int headerMod(Header h, rpmtd td)
     /* free after we've grabbed the new data in case the two are intertwined;
        that's a bad idea but at least we won't break */
     oldData = entry->data;
+    exportDirty(h, entry);
 
     entry->info.count = td->count;
     entry->info.type = td->type;
@@ -1787,7 +2234,7 @@ static indexEntry nextIndex(HeaderIterator hi)
 
     for (slot = hi->next_index; slot < h->indexUsed; slot++) {
 	entry = h->index + slot;
-	if (!ENTRY_IS_REGION(entry))
+	if (!ENTRY_IS_REGION(entry) && entryDecode(h, entry) == 0)
 	    break;
     }
     hi->next_index = slot;
@@ -1812,7 +2259,7 @@ int headerNext(HeaderIterator hi, rpmtd td)
     rpmtdReset(td);
     if (entry) {
 	td->tag = entry->info.tag;
-	rc = copyTdEntry(entry, td, HEADERGET_DEFAULT);
+	rc = copyTdEntry(hi->h, entry, td, HEADERGET_DEFAULT);
     }
     return ((rc == 1) ? 1 : 0);
 }
@@ -2042,8 +2489,8 @@ exit:
     return rc;
 }
 
-rpmRC hdrblobInit(const void *uh, size_t uc,
-		rpmTagVal regionTag, int exact_size,
+static rpmRC hdrblobSetup(const void *uh, size_t uc,
+		rpmTagVal regionTag, int exact_size, int verify,
 		struct hdrblob_s *blob, char **emsg)
 {
     rpmRC rc = RPMRC_FAIL;
@@ -2076,7 +2523,7 @@ rpmRC hdrblobInit(const void *uh, size_t uc,
 	goto exit;
 
     /* Sanity check the rest of the header structure. */
-    if (hdrblobVerifyInfo(blob, emsg))
+    if (verify && hdrblobVerifyInfo(blob, emsg))
 	goto exit;
 
     rc = RPMRC_OK;
@@ -2085,6 +2532,13 @@ exit:
     return rc;
 }
 
+rpmRC hdrblobInit(const void *uh, size_t uc,
+		rpmTagVal regionTag, int exact_size,
+		struct hdrblob_s *blob, char **emsg)
+{
+    return hdrblobSetup(uh, uc, regionTag, exact_size, 1, blob, emsg);
+}
+
 rpmRC hdrblobGet(hdrblob blob, uint32_t tag, rpmtd td)
 {
     rpmRC rc = RPMRC_NOTFOUND;
@@ -2115,7 +2569,7 @@ rpmRC hdrblobGet(hdrblob blob, uint32_t tag, rpmtd td)
 	}
 	entry.rdlen = 0;
 	td->tag = einfo.tag;
-	rc = copyTdEntry(&entry, td, HEADERGET_MINMEM) ? RPMRC_OK : RPMRC_FAIL;
+	rc = copyTdEntry(NULL, &entry, td, HEADERGET_MINMEM) ? RPMRC_OK : RPMRC_FAIL;
 	break;
     }
     return rc;
@@ -2136,9 +2590,11 @@ Header headerImport(void * blob, unsigned int bsize, headerImportFlags flags)
 	b = memcpy(xmalloc(bsize), b, bsize);
     }
 
-    /* Sanity checks on header intro. */
-    if (hdrblobInit(b, bsize, 0, 0, &hblob, &buf) == RPMRC_OK)
-	hdrblobImport(&hblob, (flags & HEADERIMPORT_FAST), &h, &buf);
+    /* Sanity checks on header intro, lazy entries are checked on access */
+    if (hdrblobSetup(b, bsize, 0, 0, !(flags & HEADERIMPORT_LAZY),
+		     &hblob, &buf) == RPMRC_OK) {
+	hdrblobImport(&hblob, flags, &h, &buf);
+    }
 
 exit:
     if (h == NULL && b != blob)
@@ -24,6 +24,17 @@ struct hdrblob_s {
     uint32_t rdl;
 };
 
+/** \ingroup header
+ * Cursor of a RPMTD_PACKED string array, walking the NUL-separated
+ * strings in header memory instead of a pointer table.
+ */
+typedef struct rpmtdPacked_s * rpmtdPacked;
+struct rpmtdPacked_s {
+    const char *base;		/*!< First string */
+    const char *str;		/*!< String at index ix */
+    int ix;			/*!< Index of current string */
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -43,7 +54,8 @@ RPM_GNUC_INTERNAL
 rpmRC hdrblobRead(FD_t fd, int magic, int exact_size, rpmTagVal regionTag, hdrblob blob, char **emsg);
 
 RPM_GNUC_INTERNAL
-rpmRC hdrblobImport(hdrblob blob, int fast, Header *hdrp, char **emsg);
+rpmRC hdrblobImport(hdrblob blob, headerImportFlags flags, Header *hdrp,
+		    char **emsg);
 
 RPM_GNUC_INTERNAL
 rpmRC hdrblobGet(hdrblob blob, uint32_t tag, rpmtd td);
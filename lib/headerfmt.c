@@ -818,6 +818,61 @@ static unsigned int tagId(rpmTagVal tag)
     return tag;
 }
 
+static void collectTags(sprintfToken format, int num,
+			rpmTagVal **tagsp, int *ntagsp)
+{
+    for (int i = 0; i < num; i++) {
+	sprintfTag tag = NULL;
+
+	switch (format[i].type) {
+	case PTOK_TAG:
+	    tag = &format[i].u.tag;
+	    break;
+	case PTOK_ARRAY:
+	    collectTags(format[i].u.array.format,
+			format[i].u.array.numTokens, tagsp, ntagsp);
+	    break;
+	case PTOK_COND:
+	    tag = &format[i].u.cond.tag;
+	    collectTags(format[i].u.cond.ifFormat,
+			format[i].u.cond.numIfTokens, tagsp, ntagsp);
+	    collectTags(format[i].u.cond.elseFormat,
+			format[i].u.cond.numElseTokens, tagsp, ntagsp);
+	    break;
+	case PTOK_NONE:
+	case PTOK_STRING:
+	default:
+	    break;
+	}
+
+	if (tag) {
+	    *tagsp = xrealloc(*tagsp, (*ntagsp + 1) * sizeof(**tagsp));
+	    (*tagsp)[(*ntagsp)++] = tag->tag;
+	}
+    }
+}
+
+int headerFormatTags(const char * fmt, rpmTagVal **tagsp, int *ntagsp)
+{
+    struct headerSprintfArgs_s hsa;
+    int rc;
+
+    memset(&hsa, 0, sizeof(hsa));
+    hsa.fmt = xstrdup(fmt);
+    *tagsp = NULL;
+    *ntagsp = 0;
+
+    rc = parseFormat(&hsa, hsa.fmt, &hsa.format, &hsa.numTokens, NULL,
+		     PARSER_BEGIN);
+    if (rc == 0) {
+	collectTags(hsa.format, hsa.numTokens, tagsp, ntagsp);
+	hsa.format = freeFormat(hsa.format, hsa.numTokens);
+    }
+
+    free(hsa.fmt);
+    return rc;
+}
+
 char * headerFormat(Header h, const char * fmt, errmsg_t * errmsg) 
 {
     struct headerSprintfArgs_s hsa;
@@ -41,6 +41,10 @@ headerFmt rpmHeaderFormatByValue(rpmtdFormats fmt);
 RPM_GNUC_INTERNAL
 char * rpmHeaderFormatCall(headerFmt fmt, rpmtd td);
 
+/* Return the tags (-2 for all of them) a header format looks at */
+RPM_GNUC_INTERNAL
+int headerFormatTags(const char * fmt, rpmTagVal **tagsp, int *ntagsp);
+
 RPM_GNUC_INTERNAL
 int headerFindSpec(Header h);
 
@@ -62,6 +66,20 @@ RPM_GNUC_INTERNAL
 void rpmRelocationBuild(Header h, rpmRelocation *rawrelocs,
 		int *rnrelocs, rpmRelocation **rrelocs, uint8_t **rbadrelocs);
 
+/**
+ * Read a package file, like rpmReadPackageFile() but with control
+ * over how the main header is imported.
+ * @param ts		transaction set
+ * @param fd		file handle
+ * @param fn		file name
+ * @param importFlags	main header import flags
+ * @param[out] hdrp	address of header (or NULL)
+ * @return		RPMRC_OK on success
+ */
+RPM_GNUC_INTERNAL
+rpmRC rpmpkgReadFile(rpmts ts, FD_t fd, const char * fn,
+		    headerImportFlags importFlags, Header * hdrp);
+
 #ifdef __cplusplus
 }
 #endif
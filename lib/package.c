@@ -4,6 +4,7 @@
 
 #include "system.h"
 
+#include <errno.h>
 #include <netinet/in.h>
 #include <pthread.h>
 
@@ -12,10 +13,12 @@
 #include <rpm/rpmlog.h>
 #include <rpm/rpmstring.h>
 #include <rpm/rpmkeyring.h>
+#include <rpm/rpmmacro.h>
 
 #include "lib/rpmlead.h"
 #include "rpmio/rpmio_internal.h"	/* fd digest bits */
 #include "lib/header_internal.h"	/* XXX headerCheck */
+#include "lib/misc.h"
 #include "lib/rpmvs.h"
 
 #include "debug.h"
@@ -198,7 +201,9 @@ rpmRC headerCheck(rpmts ts, const void * uh, size_t uc, char ** msg)
 	struct rpmvs_s *vs = rpmvsCreate(0, vsflags, keyring);
 	rpmDigestBundle bundle = rpmDigestBundleNew();
 
-	rpmswEnter(rpmtsOp(ts, RPMTS_OP_DIGEST), 0);
+	/* Time locally, rpmdbRebuild() checks headers in parallel */
+	struct rpmop_s op = { 0 };
+	rpmswEnter(&op, 0);
 
 	rpmvsInit(vs, &blob, bundle);
 	rpmvsInitRange(vs, RPMSIG_HEADER);
@@ -207,7 +212,9 @@ rpmRC headerCheck(rpmts ts, const void * uh, size_t uc, char ** msg)
 
 	rpmvsVerify(vs, RPMSIG_VERIFIABLE_TYPE, handleHdrVS, &pkgdata);
 
-	rpmswExit(rpmtsOp(ts, RPMTS_OP_DIGEST), uc);
+	rpmswExit(&op, uc);
+	#pragma omp critical(tsop)
+	rpmswAdd(rpmtsOp(ts, RPMTS_OP_DIGEST), &op);
 
 	rc = pkgdata.rc;
 
@@ -234,12 +241,15 @@ rpmRC rpmReadHeader(rpmts ts, FD_t fd, Header *hdrp, char ** msg)
     struct hdrblob_s blob;
     Header h = NULL;
     rpmRC rc = RPMRC_FAIL;		/* assume failure */
+    int buffered;
 
     if (hdrp)
 	*hdrp = NULL;
     if (msg)
 	*msg = NULL;
 
+    buffered = fdPushBuffer(fd, rpmExpandNumeric("%{?_pkg_read_bufsize}"));
+
     if (hdrblobRead(fd, 1, 1, RPMTAG_HEADERIMMUTABLE, &blob, &buf) != RPMRC_OK)
 	goto exit;
 
@@ -247,6 +257,10 @@ rpmRC rpmReadHeader(rpmts ts, FD_t fd, Header *hdrp, char ** msg)
     rc = hdrblobImport(&blob, 0, &h, &buf);
     
 exit:
+    if (buffered && fdPopBuffer(fd) && rc == RPMRC_OK) {
+	rasprintf(&buf, _("seek failed: %s"), strerror(errno));
+	rc = RPMRC_FAIL;
+    }
     if (hdrp && h && rc == RPMRC_OK)
 	*hdrp = headerLink(h);
     headerFree(h);
@@ -330,7 +344,8 @@ static void loghdrmsg(struct rpmsinfo_s *sinfo, struct pkgdata_s *pkgdata,
     rpmlog(lvl, "%s: %s\n", pkgdata->fn, msg);
 }
 
-rpmRC rpmReadPackageFile(rpmts ts, FD_t fd, const char * fn, Header * hdrp)
+rpmRC rpmpkgReadFile(rpmts ts, FD_t fd, const char * fn,
+		    headerImportFlags importFlags, Header * hdrp)
 {
     char *msg = NULL;
     Header h = NULL;
@@ -362,7 +377,7 @@ rpmRC rpmReadPackageFile(rpmts ts, FD_t fd, const char * fn, Header * hdrp)
 	if (hdrp) {
 	    if (hdrblobImport(sigblob, 0, &sigh, &msg))
 		goto exit;
-	    if (hdrblobImport(blob, 0, &h, &msg))
+	    if (hdrblobImport(blob, importFlags, &h, &msg))
 		goto exit;
 
 	    /* Append (and remap) signature tags to the metadata. */
@@ -394,5 +409,10 @@ exit:
     return rc;
 }
 
+rpmRC rpmReadPackageFile(rpmts ts, FD_t fd, const char * fn, Header * hdrp)
+{
+    return rpmpkgReadFile(ts, fd, fn, 0, hdrp);
+}
+
 
 
@@ -21,6 +21,8 @@
 
 #include "lib/rpmgi.h"
 #include "lib/manifest.h"
+#include "lib/misc.h"		/* headerFormatTags() */
+#include "lib/rpmdb_internal.h"	/* rpmdbSetIteratorTags() */
 
 #include "debug.h"
 
@@ -285,6 +287,17 @@ static int rpmcliShowMatches(QVA_t qva, rpmts ts, rpmdbMatchIterator mi)
     if (mi == NULL)
 	return 1;
 
+    /* Plain format queries may get by with the package summary */
+    if (qva->qva_showPackage == showQueryPackage &&
+	qva->qva_queryFormat != NULL && qva->qva_incattr == 0 &&
+	!(qva->qva_flags & _QUERY_FOR_BITS)) {
+	rpmTagVal *tags = NULL;
+	int ntags = 0;
+	if (headerFormatTags(qva->qva_queryFormat, &tags, &ntags) == 0)
+	    rpmdbSetIteratorTags(mi, tags, ntags);
+	free(tags);
+    }
+
     while ((h = rpmdbNextIterator(mi)) != NULL) {
 	int rc;
 	if ((rc = qva->qva_showPackage(qva, ts, h)) != 0)
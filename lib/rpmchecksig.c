@@ -6,6 +6,7 @@
 #include "system.h"
 
 #include <ctype.h>
+#include <errno.h>
 
 #include <rpm/rpmlib.h>			/* RPMSIGTAG & related */
 #include <rpm/rpmpgp.h>
@@ -16,6 +17,7 @@
 #include <rpm/rpmlog.h>
 #include <rpm/rpmstring.h>
 #include <rpm/rpmkeyring.h>
+#include <rpm/rpmmacro.h>
 
 #include "rpmio/rpmio_internal.h" 	/* fdSetBundle() */
 #include "lib/rpmlead.h"
@@ -107,14 +109,17 @@ int rpmcliImportPubkeys(rpmts ts, ARGV_const_t argv)
 
 static int readFile(FD_t fd, char **msg)
 {
-    unsigned char buf[4*BUFSIZ];
+    /* Big enough for the payload digests to be updated in parallel */
+    size_t bufsize = 1024 * 1024;
+    unsigned char *buf = xmalloc(bufsize);
     ssize_t count;
 
     /* Read the payload from the package. */
-    while ((count = Fread(buf, sizeof(buf[0]), sizeof(buf), fd)) > 0) {}
+    while ((count = Fread(buf, sizeof(buf[0]), bufsize, fd)) > 0) {}
     if (count < 0)
 	rasprintf(msg, _("Fread failed: %s"), Fstrerror(fd));
 
+    free(buf);
     return (count != 0);
 }
 
@@ -147,6 +152,7 @@ rpmRC rpmpkgRead(struct rpmvs_s *vs, FD_t fd,
     hdrblob sigblob = hdrblobCreate();
     hdrblob blob = hdrblobCreate();
     rpmDigestBundle bundle = fdGetBundle(fd, 1); /* freed with fd */
+    int buffered = fdPushBuffer(fd, rpmExpandNumeric("%{?_pkg_read_bufsize}"));
 
     if ((xx = rpmLeadRead(fd, &msg)) != RPMRC_OK) {
 	/* Avoid message spew on manifests */
@@ -198,6 +204,10 @@ rpmRC rpmpkgRead(struct rpmvs_s *vs, FD_t fd,
     rc = RPMRC_OK;
 
 exit:
+    if (buffered && fdPopBuffer(fd) && rc == RPMRC_OK) {
+	rasprintf(&msg, _("seek failed: %s"), strerror(errno));
+	rc = RPMRC_FAIL;
+    }
     if (emsg)
 	*emsg = msg;
     else
@@ -23,15 +23,18 @@
 #include <rpm/rpmsq.h>
 #include <rpm/rpmstring.h>
 #include <rpm/rpmfileutil.h>
+#include <rpm/rpmkeyring.h>
 #include <rpm/rpmds.h>			/* XXX isInstallPreReq macro only */
 #include <rpm/rpmlog.h>
 #include <rpm/rpmdb.h>
 #include <rpm/rpmts.h>
+#include <rpm/rpmlib.h>		/* headerCheck() */
 #include <rpm/argv.h>
 
 #include "lib/rpmchroot.h"
 #include "lib/rpmdb_internal.h"
 #include "lib/fprint.h"
+#include "lib/rpmdbsum.h"
 #include "lib/header_internal.h"	/* XXX for headerSetInstance() */
 #include "lib/backend/dbi.h"
 #include "lib/backend/dbiset.h"
@@ -50,6 +53,146 @@
 #undef HTKEYTYPE
 #undef HTDATATYPE
 
+/*
+ * Bounded cache of loaded and checked header blobs, keyed by header
+ * instance. Every user imports a header of its own from the blob, so
+ * changes to one iterator's header are never seen by another.
+ */
+struct hdrCacheEntry_s {
+    unsigned int hdrNum;	/*!< header instance, 0 if unused */
+    void *blob;			/*!< raw header blob */
+    unsigned int bloblen;	/*!< raw header blob length */
+    unsigned int stamp;		/*!< last use, for LRU eviction */
+    int next;			/*!< next entry in bucket chain, -1 terminates */
+};
+
+struct hdrCache_s {
+    int size;			/*!< number of entries */
+    int used;			/*!< number of entries in use */
+    unsigned int clock;		/*!< use counter */
+    unsigned int mask;		/*!< bucket mask */
+    int *buckets;		/*!< bucket chain heads */
+    struct hdrCacheEntry_s *entries;
+};
+
+static struct hdrCache_s *hdrCacheCreate(int size)
+{
+    struct hdrCache_s *c = NULL;
+    unsigned int nbuckets = 1;
+
+    if (size <= 0)
+	return NULL;
+
+    while (nbuckets < (unsigned int) size)
+	nbuckets <<= 1;
+
+    c = xcalloc(1, sizeof(*c));
+    c->size = size;
+    c->mask = nbuckets - 1;
+    c->buckets = xmalloc(nbuckets * sizeof(*c->buckets));
+    for (unsigned int i = 0; i < nbuckets; i++)
+	c->buckets[i] = -1;
+    c->entries = xcalloc(size, sizeof(*c->entries));
+    return c;
+}
+
+static struct hdrCache_s *hdrCacheFree(struct hdrCache_s *c)
+{
+    if (c) {
+	for (int i = 0; i < c->used; i++)
+	    free(c->entries[i].blob);
+	free(c->buckets);
+	free(c->entries);
+	free(c);
+    }
+    return NULL;
+}
+
+static int hdrCacheFind(struct hdrCache_s *c, unsigned int hdrNum)
+{
+    int i = c->buckets[hdrNum & c->mask];
+    while (i >= 0 && c->entries[i].hdrNum != hdrNum)
+	i = c->entries[i].next;
+    return i;
+}
+
+/* Unlink entry i from its chain and fill the hole with the last entry */
+static void hdrCacheDrop(struct hdrCache_s *c, int i)
+{
+    int *ip;
+    int last = --c->used;
+
+    for (ip = &c->buckets[c->entries[i].hdrNum & c->mask]; *ip != i;
+	 ip = &c->entries[*ip].next)
+	;
+    *ip = c->entries[i].next;
+    free(c->entries[i].blob);
+
+    if (i != last) {
+	for (ip = &c->buckets[c->entries[last].hdrNum & c->mask]; *ip != last;
+	     ip = &c->entries[*ip].next)
+	    ;
+	*ip = i;
+	c->entries[i] = c->entries[last];
+    }
+    memset(&c->entries[last], 0, sizeof(c->entries[last]));
+}
+
+/* Return a cached header blob, NULL if not cached */
+static const void *hdrCacheGet(struct hdrCache_s *c, unsigned int hdrNum,
+			       unsigned int *bloblen)
+{
+    int i = hdrCacheFind(c, hdrNum);
+    if (i < 0)
+	return NULL;
+    c->entries[i].stamp = ++c->clock;
+    *bloblen = c->entries[i].bloblen;
+    return c->entries[i].blob;
+}
+
+static void hdrCachePut(struct hdrCache_s *c, unsigned int hdrNum,
+			const void *blob, unsigned int bloblen)
+{
+    struct hdrCacheEntry_s *e;
+    int i = hdrCacheFind(c, hdrNum);
+
+    if (i >= 0) {
+	hdrCacheDrop(c, i);
+    } else if (c->used == c->size) {
+	int lru = 0;
+	for (i = 1; i < c->used; i++) {
+	    if (c->entries[i].stamp < c->entries[lru].stamp)
+		lru = i;
+	}
+	hdrCacheDrop(c, lru);
+    }
+
+    i = c->used++;
+    e = &c->entries[i];
+    e->hdrNum = hdrNum;
+    e->blob = memcpy(xmalloc(bloblen), blob, bloblen);
+    e->bloblen = bloblen;
+    e->stamp = ++c->clock;
+    e->next = c->buckets[hdrNum & c->mask];
+    c->buckets[hdrNum & c->mask] = i;
+}
+
+static void hdrCacheDel(struct hdrCache_s *c, unsigned int hdrNum)
+{
+    int i;
+    if (c && (i = hdrCacheFind(c, hdrNum)) >= 0)
+	hdrCacheDrop(c, i);
+}
+
+/* Package summary states */
+enum dbSumState_e {
+    SUMMARY_UNKNOWN	= 0,	/*!< not looked at yet */
+    SUMMARY_NONE	= 1,	/*!< disabled, or no current summary */
+    SUMMARY_CLEAN	= 2,	/*!< loaded, matches the database */
+    SUMMARY_DIRTY	= 3,	/*!< loaded and updated, write on close */
+    SUMMARY_REBUILD	= 4,	/*!< database changed without it, rebuild on close */
+};
+
 static rpmdb rpmdbUnlink(rpmdb db);
 
 static int buildIndexes(rpmdb db)
@@ -289,6 +432,25 @@ struct rpmdbMatchIterator_s {
     rpmts		mi_ts;
     rpmRC (*mi_hdrchk) (rpmts ts, const void * uh, size_t uc, char ** msg);
 
+    struct miPrefetch_s *mi_pf;	/*!< headers decoded ahead (full scans) */
+    int			mi_pfsize;	/*!< prefetch batch size, 0 disables */
+    int			mi_npf;		/*!< number of prefetched entries */
+    int			mi_pfx;		/*!< next prefetched entry */
+    int			mi_pfdone;	/*!< end of the scan reached? */
+    int			mi_pfnre;	/*!< no. of selectors the batch saw */
+    int			mi_summary;	/*!< return package summary headers? */
+};
+
+/* A header decoded ahead of the caller by a full scan iterator */
+struct miPrefetch_s {
+    unsigned int offset;	/*!< header instance */
+    unsigned char *blob;	/*!< private copy of the header blob */
+    unsigned int bloblen;
+    Header h;			/*!< decoded header, NULL if skipped */
+    rpmRC chkrc;		/*!< header check result */
+    int checked;		/*!< was the header checked now? */
+    int damaged;		/*!< did the header fail to import? */
+    char *msg;			/*!< header check message */
 };
 
 struct rpmdbIndexIterator_s {
@@ -315,6 +477,18 @@ rpmop rpmdbOp(rpmdb rpmdb, rpmdbOpX opx)
     case RPMDB_OP_DBDEL:
 	op = &rpmdb->db_delops;
 	break;
+    case RPMDB_OP_DBPREP:
+	op = &rpmdb->db_prepops;
+	break;
+    case RPMDB_OP_DBSTMT:
+	op = &rpmdb->db_stmtops;
+	break;
+    case RPMDB_OP_HDRCACHE:
+	op = &rpmdb->db_hdrcacheops;
+	break;
+    case RPMDB_OP_HDRLOAD:
+	op = &rpmdb->db_hdrloadops;
+	break;
     default:
 	break;
     }
@@ -363,6 +537,97 @@ static int dbiForeach(dbiIndex *dbis, int ndbi,
     return rc;
 }
 
+static char *dbSummaryPath(rpmdb db)
+{
+    return rpmGenPath(rpmdbHome(db), "rpmdb.summary", NULL);
+}
+
+/* Return the package summary if enabled and current, loading on first use */
+static rpmdbsum dbSummary(rpmdb db)
+{
+    if (db->db_sumstate == SUMMARY_UNKNOWN) {
+	db->db_sumstate = SUMMARY_NONE;
+	if (rpmExpandNumeric("%{?_db_summary}") > 0) {
+	    char *path = dbSummaryPath(db);
+	    char *cookie = rpmdbCookie(db);
+	    db->db_summary = rpmdbsumRead(path, cookie);
+	    if (db->db_summary)
+		db->db_sumstate = SUMMARY_CLEAN;
+	    free(cookie);
+	    free(path);
+	}
+    }
+    return db->db_summary;
+}
+
+/*
+ * Keep the package summary in line with a database change: an added
+ * header blob, or a removal if NULL. Summarize the blob rather than
+ * the header it came from, the two can differ in deleted region tags.
+ */
+static void dbSummaryUpdate(rpmdb db, unsigned int hdrNum,
+			    const void *blob, unsigned int bloblen, int ok)
+{
+    switch (db->db_sumstate) {
+    case SUMMARY_CLEAN:
+    case SUMMARY_DIRTY:
+	if (ok && blob) {
+	    Header h = headerImport((void *) blob, bloblen, HEADERIMPORT_COPY |
+				    HEADERIMPORT_FAST | HEADERIMPORT_LAZY);
+	    if (h)
+		rpmdbsumAdd(db->db_summary, hdrNum, h);
+	    ok = (h != NULL);
+	    headerFree(h);
+	} else if (ok) {
+	    rpmdbsumDel(db->db_summary, hdrNum);
+	}
+	if (ok) {
+	    db->db_sumstate = SUMMARY_DIRTY;
+	    break;
+	}
+	/* The database is in some half-way state now, start over */
+	db->db_summary = rpmdbsumFree(db->db_summary);
+	/* fallthrough */
+    case SUMMARY_NONE:
+	if (rpmExpandNumeric("%{?_db_summary}") > 0)
+	    db->db_sumstate = SUMMARY_REBUILD;
+	break;
+    default:
+	break;
+    }
+}
+
+/* Write out a changed package summary, building it first if necessary */
+static void dbSummarySync(rpmdb db)
+{
+    char *path, *cookie;
+
+    if (db->db_sumstate == SUMMARY_REBUILD) {
+	rpmdbMatchIterator mi = rpmdbInitIterator(db, RPMDBI_PACKAGES, NULL, 0);
+	Header h;
+
+	if (mi == NULL)
+	    return;
+
+	rpmlog(RPMLOG_DEBUG, "building package summary\n");
+	db->db_summary = rpmdbsumNew();
+	while ((h = rpmdbNextIterator(mi)) != NULL)
+	    rpmdbsumAdd(db->db_summary, headerGetInstance(h), h);
+	rpmdbFreeIterator(mi);
+	db->db_sumstate = SUMMARY_DIRTY;
+    }
+
+    if (db->db_sumstate != SUMMARY_DIRTY)
+	return;
+
+    path = dbSummaryPath(db);
+    cookie = rpmdbCookie(db);
+    if (rpmdbsumWrite(db->db_summary, path, cookie, db->db_perms) == 0)
+	db->db_sumstate = SUMMARY_CLEAN;
+    free(cookie);
+    free(path);
+}
+
 int rpmdbClose(rpmdb db)
 {
     int rc = 0;
@@ -370,6 +635,10 @@ int rpmdbClose(rpmdb db)
     if (db == NULL)
 	goto exit;
 
+    /* Iterating the database on the way out needs it open still */
+    if (db->nrefs == 1)
+	dbSummarySync(db);
+
     (void) rpmdbUnlink(db);
 
     if (db->nrefs > 0)
@@ -387,6 +656,8 @@ int rpmdbClose(rpmdb db)
     db->db_home = _free(db->db_home);
     db->db_fullpath = _free(db->db_fullpath);
     db->db_checked = dbChkFree(db->db_checked);
+    db->db_hdrcache = hdrCacheFree(db->db_hdrcache);
+    db->db_summary = rpmdbsumFree(db->db_summary);
     db->db_indexes = _free(db->db_indexes);
 
     db = _free(db);
@@ -442,6 +713,9 @@ static rpmdb newRpmdb(const char * root, const char * home,
     db->db_tags = dbiTags;
     db->db_ndbi = sizeof(dbiTags) / sizeof(rpmDbiTag);
     db->db_indexes = xcalloc(db->db_ndbi, sizeof(*db->db_indexes));
+    /* Rebuild reads every header exactly once, caching is pointless there */
+    if (!(db->db_flags & RPMDB_FLAG_REBUILD))
+	db->db_hdrcache = hdrCacheCreate(rpmExpandNumeric("%{?_db_hdrcache}"));
     db->nrefs = 0;
     return rpmdbLink(db);
 }
@@ -915,6 +1189,8 @@ static int miFreeHeader(rpmdbMatchIterator mi, dbiIndex dbi)
 	unsigned int hdrLen = 0;
 	unsigned char *hdrBlob = headerExport(mi->mi_h, &hdrLen);
 
+	hdrCacheDel(mi->mi_db->db_hdrcache, mi->mi_prevoffset);
+
 	/* Check header digest/signature on blob export (if requested). */
 	if (mi->mi_hdrchk && mi->mi_ts) {
 	    char * msg = NULL;
@@ -963,6 +1239,13 @@ rpmdbMatchIterator rpmdbFreeIterator(rpmdbMatchIterator mi)
 
     miFreeHeader(mi, dbi);
 
+    for (i = mi->mi_pfx; i < mi->mi_npf; i++) {
+	headerFree(mi->mi_pf[i].h);
+	free(mi->mi_pf[i].blob);
+	free(mi->mi_pf[i].msg);
+    }
+    mi->mi_pf = _free(mi->mi_pf);
+
     mi->mi_dbc = dbiCursorFree(dbi, mi->mi_dbc);
 
     if (mi->mi_re != NULL)
@@ -1271,7 +1554,7 @@ int rpmdbSetIteratorRE(rpmdbMatchIterator mi, rpmTagVal tag,
  * @param mi		rpm database iterator
  * @return		1 if header should be skipped
  */
-static int mireSkip (const rpmdbMatchIterator mi)
+static int mireSkip (const rpmdbMatchIterator mi, Header h)
 {
     miRE mire;
     uint32_t zero = 0;
@@ -1279,7 +1562,7 @@ static int mireSkip (const rpmdbMatchIterator mi)
     int nmatches = 0;
     int rc;
 
-    if (mi->mi_h == NULL)	/* XXX can't happen */
+    if (h == NULL)	/* XXX can't happen */
 	return 0;
 
     /*
@@ -1291,7 +1574,7 @@ static int mireSkip (const rpmdbMatchIterator mi)
 	int anymatch;
 	struct rpmtd_s td;
 
-	if (!headerGet(mi->mi_h, mire->tag, &td, HEADERGET_MINMEM)) {
+	if (!headerGet(h, mire->tag, &td, HEADERGET_MINMEM)) {
 	    if (mire->tag != RPMTAG_EPOCH) {
 		ntags++;
 		continue;
@@ -1331,6 +1614,111 @@ static int mireSkip (const rpmdbMatchIterator mi)
     return (ntags == nmatches ? 0 : 1);
 }
 
+/*
+ * Can selectors on a tag be evaluated against its index instead of the
+ * headers? Only when the index holds every value of the tag, so that the
+ * index matches are a superset of what mireSkip() lets through.
+ * I18N tags such as Group never qualify: the headers are matched in the
+ * current locale, which the untranslated index values need not cover.
+ */
+static int mirePushable(rpmTagVal tag)
+{
+    if (rpmTagGetTagType(tag) == RPM_I18NSTRING_TYPE)
+	return 0;
+
+    switch (tag) {
+    case RPMTAG_NAME:
+    case RPMTAG_PROVIDENAME:
+    case RPMTAG_CONFLICTNAME:
+    case RPMTAG_OBSOLETENAME:
+    case RPMTAG_RECOMMENDNAME:
+    case RPMTAG_SUGGESTNAME:
+    case RPMTAG_SUPPLEMENTNAME:
+    case RPMTAG_ENHANCENAME:
+	return 1;
+    default:
+	return 0;
+    }
+}
+
+struct mireKeys_s {
+    miRE mire;		/*!< first selector of the tag */
+    int nmire;		/*!< number of selectors on the tag */
+};
+
+/* Does an index key match any of the selectors of the tag? */
+static int mireKeyMatch(void *data, const char *keyp, size_t keylen)
+{
+    struct mireKeys_s *mk = data;
+    char *key = memcpy(xmalloc(keylen + 1), keyp, keylen);
+    int match = 0;
+
+    key[keylen] = '\0';
+    for (int i = 0; i < mk->nmire && !match; i++)
+	match = (miregexec(mk->mire + i, key) == 0);
+    free(key);
+
+    return match;
+}
+
+/*
+ * Turn a full scan with selectors into an index iteration over the
+ * headers the indexed selectors can match. mireSkip() still has the final
+ * say on every header, this only avoids loading the ones that can't match.
+ */
+static void miPushdown(rpmdbMatchIterator mi)
+{
+    dbiIndexSet set = NULL;
+    int i = 0;
+
+    while (i < mi->mi_nre) {
+	miRE mire = mi->mi_re + i;
+	int pushable = mirePushable(mire->tag);
+	dbiIndex dbi = NULL;
+	int j;
+
+	/* Selectors are sorted by tag, and or'ed within the tag */
+	for (j = i; j < mi->mi_nre && mi->mi_re[j].tag == mire->tag; j++) {
+	    if (mi->mi_re[j].notmatch)
+		pushable = 0;
+	}
+
+	if (pushable && indexOpen(mi->mi_db, mire->tag, 0, &dbi) == 0) {
+	    struct mireKeys_s mk = { mire, j - i };
+	    dbiIndexSet tset = NULL;
+	    dbiCursor dbc = dbiCursorInit(dbi, DBC_READ);
+	    rpmRC rc = idxdbFilter(dbi, dbc, mireKeyMatch, &mk, &tset);
+
+	    dbiCursorFree(dbi, dbc);
+	    if (rc == RPMRC_FAIL) {
+		/* Fall back to checking every header */
+		dbiIndexSetFree(tset);
+		set = dbiIndexSetFree(set);
+		return;
+	    }
+
+	    if (tset == NULL)
+		tset = dbiIndexSetNew(0);
+	    /* Only the packages matter, not which of their entries matched */
+	    for (unsigned int k = 0; k < tset->count; k++)
+		tset->recs[k].tagNum = 0;
+	    dbiIndexSetUniq(tset, 0);
+	    if (set == NULL) {
+		set = tset;
+	    } else {
+		dbiIndexSetFilterSet(set, tset, 1);
+		dbiIndexSetFree(tset);
+	    }
+	}
+	i = j;
+    }
+
+    if (set) {
+	mi->mi_set = set;
+	mi->mi_sorted = 1;
+    }
+}
+
 int rpmdbSetIteratorRewrite(rpmdbMatchIterator mi, int rewrite)
 {
     int rc;
@@ -1401,14 +1789,268 @@ static rpmRC miVerifyHeader(rpmdbMatchIterator mi, const void *uh, size_t uhlen)
     return rpmrc;
 }
 
+/* Check and decode a prefetched header, called from worker threads */
+static void miPrefetchPrepare(rpmdbMatchIterator mi, struct miPrefetch_s *item)
+{
+    if (mi->mi_hdrchk && mi->mi_ts) {
+	rpmRC *res;
+
+	/* The checked cache is only read here, new results go in later */
+	item->chkrc = RPMRC_NOTFOUND;
+	if (mi->mi_db->db_checked &&
+	    dbChkGetEntry(mi->mi_db->db_checked, item->offset, &res, NULL, NULL))
+	    item->chkrc = res[0];
+
+	if (item->chkrc != RPMRC_OK) {
+	    item->chkrc = (*mi->mi_hdrchk) (mi->mi_ts, item->blob,
+					    item->bloblen, &item->msg);
+	    item->checked = 1;
+	}
+	if (item->chkrc == RPMRC_FAIL)
+	    goto exit;
+    }
+
+    /* The blob is our private copy, let the header take it over */
+    item->h = headerImport(item->blob, item->bloblen,
+			   HEADERIMPORT_FAST | HEADERIMPORT_LAZY);
+    if (item->h)
+	item->blob = NULL;
+    if (item->h == NULL || !headerIsEntry(item->h, RPMTAG_NAME)) {
+	item->h = headerFree(item->h);
+	item->damaged = 1;
+	goto exit;
+    }
+    headerSetInstance(item->h, item->offset);
+
+    if (mireSkip(mi, item->h))
+	item->h = headerFree(item->h);
+
+exit:
+    item->blob = _free(item->blob);
+}
+
+/*
+ * Read the next batch of headers of a full scan and check, decode and
+ * filter them in parallel. Returns the number of entries read.
+ */
+static int miPrefetch(rpmdbMatchIterator mi, dbiIndex dbi)
+{
+    rpmop op = &mi->mi_db->db_hdrloadops;
+    unsigned int bytes = 0;
+    int n = 0;
+
+    if (mi->mi_pf == NULL) {
+	mi->mi_pf = xmalloc(mi->mi_pfsize * sizeof(*mi->mi_pf));
+	/* Load the keyring now, not racing from the checking threads */
+	if (mi->mi_hdrchk && mi->mi_ts)
+	    rpmKeyringFree(rpmtsGetKeyring(mi->mi_ts, 1));
+    }
+    mi->mi_npf = mi->mi_pfx = 0;
+
+    if (mi->mi_pfdone)
+	return 0;
+
+    rpmswEnter(op, 0);
+    while (n < mi->mi_pfsize) {
+	struct miPrefetch_s *item = &mi->mi_pf[n];
+	unsigned char *uh = NULL;
+	unsigned int uhlen = 0;
+	unsigned int offset = 0;
+
+	if (pkgdbGet(dbi, mi->mi_dbc, 0, &uh, &uhlen) == 0)
+	    offset = pkgdbKey(dbi, mi->mi_dbc);
+
+	/* Terminate on error or end of keys, as the unbuffered path does */
+	if (uh == NULL || (offset == 0 && mi->mi_setx + n)) {
+	    mi->mi_pfdone = 1;
+	    break;
+	}
+	if (offset == 0) {
+	    mi->mi_setx++;
+	    continue;
+	}
+
+	/* The blob is only valid until the next cursor access */
+	memset(item, 0, sizeof(*item));
+	item->offset = offset;
+	item->blob = memcpy(xmalloc(uhlen), uh, uhlen);
+	item->bloblen = uhlen;
+	bytes += uhlen;
+	n++;
+    }
+    pkgdbRelease(dbi, mi->mi_dbc);
+
+    /* Only our own checker is known to be safe to call concurrently */
+    mi->mi_pfnre = mi->mi_nre;
+    int parallel = (mi->mi_hdrchk == NULL || mi->mi_hdrchk == headerCheck);
+    #pragma omp parallel for schedule(dynamic) if (parallel)
+    for (int i = 0; i < n; i++)
+	miPrefetchPrepare(mi, &mi->mi_pf[i]);
+
+    /* Report and remember the results in order */
+    for (int i = 0; i < n; i++) {
+	struct miPrefetch_s *item = &mi->mi_pf[i];
+	if (item->checked) {
+	    int lvl = (item->chkrc == RPMRC_FAIL ? RPMLOG_ERR : RPMLOG_DEBUG);
+	    rpmlog(lvl, "%s h#%8u %s\n",
+		(item->chkrc == RPMRC_FAIL ?
+			_("rpmdbNextIterator: skipping") : " read"),
+		item->offset, (item->msg ? item->msg : ""));
+	    item->msg = _free(item->msg);
+	    if (mi->mi_db->db_checked)
+		dbChkAddEntry(mi->mi_db->db_checked, item->offset, item->chkrc);
+	}
+	if (item->damaged) {
+	    rpmlog(RPMLOG_ERR,
+		    _("rpmdb: damaged header #%u retrieved -- skipping.\n"),
+		    item->offset);
+	}
+    }
+    rpmswExit(op, bytes);
+
+    mi->mi_npf = n;
+    return n;
+}
+
+/* Hand out the next header of a prefetching iterator */
+static Header miNextPrefetched(rpmdbMatchIterator mi, dbiIndex dbi)
+{
+    struct miPrefetch_s *item = NULL;
+
+    do {
+	if (mi->mi_pfx >= mi->mi_npf && miPrefetch(mi, dbi) == 0)
+	    return NULL;
+	item = &mi->mi_pf[mi->mi_pfx++];
+	mi->mi_setx++;
+	/* Selectors added since the batch was filtered apply too */
+	if (item->h && mi->mi_nre != mi->mi_pfnre && mireSkip(mi, item->h))
+	    item->h = headerFree(item->h);
+    } while (item->h == NULL);
+
+    /* Rewrite current header (if necessary) and unlink. */
+    miFreeHeader(mi, dbi);
+
+    mi->mi_h = item->h;
+    item->h = NULL;
+    mi->mi_offset = item->offset;
+    mi->mi_prevoffset = mi->mi_offset;
+    mi->mi_modified = 0;
+
+    return mi->mi_h;
+}
+
+/* Headers of rewriting iterators may change under us, don't share them */
+static int miCacheable(rpmdbMatchIterator mi)
+{
+    return (mi->mi_db->db_hdrcache != NULL && !(mi->mi_cflags & DBC_WRITE));
+}
+
+static Header miCachedHeader(rpmdbMatchIterator mi,
+			     headerImportFlags importFlags)
+{
+    const void *blob;
+    unsigned int bloblen = 0;
+    Header h;
+
+    if (!miCacheable(mi))
+	return NULL;
+
+    /* A checking iterator can only reuse headers that passed the check */
+    if (mi->mi_hdrchk && mi->mi_ts) {
+	rpmRC *res;
+	if (!(mi->mi_db->db_checked &&
+	      dbChkGetEntry(mi->mi_db->db_checked, mi->mi_offset,
+			    &res, NULL, NULL) && res[0] == RPMRC_OK))
+	    return NULL;
+    }
+
+    blob = hdrCacheGet(mi->mi_db->db_hdrcache, mi->mi_offset, &bloblen);
+    if (blob == NULL)
+	return NULL;
+
+    /* A header of our own, callers may change it */
+    rpmswEnter(&mi->mi_db->db_hdrcacheops, 0);
+    h = headerImport((void *) blob, bloblen, importFlags | HEADERIMPORT_COPY);
+    if (h)
+	headerSetInstance(h, mi->mi_offset);
+    rpmswExit(&mi->mi_db->db_hdrcacheops, bloblen);
+    return h;
+}
+
+int rpmdbSetIteratorTags(rpmdbMatchIterator mi,
+			 const rpmTagVal *tags, int ntags)
+{
+    rpmdbsum sum;
+
+    /* Summary headers are no good for rewriting, or once started */
+    if (mi == NULL || mi->mi_dbc || (mi->mi_cflags & DBC_WRITE))
+	return 0;
+
+    if ((sum = dbSummary(mi->mi_db)) == NULL)
+	return 0;
+
+    for (int i = 0; i < ntags; i++) {
+	if (!rpmdbsumCovers(sum, tags[i]))
+	    return 0;
+    }
+    for (int i = 0; i < mi->mi_nre; i++) {
+	if (!rpmdbsumCovers(sum, mi->mi_re[i].tag))
+	    return 0;
+    }
+
+    mi->mi_summary = 1;
+    return 1;
+}
+
+/* Return the next match as a header synthesized from the package summary */
+static Header miNextSummary(rpmdbMatchIterator mi)
+{
+    rpmdbsum sum;
+    Header h;
+
+    while ((sum = mi->mi_db->db_summary) != NULL) {
+	if (mi->mi_set) {
+	    if (!(mi->mi_setx < mi->mi_set->count))
+		return NULL;
+	    mi->mi_offset = dbiIndexRecordOffset(mi->mi_set, mi->mi_setx);
+	    mi->mi_filenum = dbiIndexRecordFileNumber(mi->mi_set, mi->mi_setx);
+	} else {
+	    mi->mi_offset = rpmdbsumNext(sum, mi->mi_offset);
+	    if (mi->mi_offset == 0)
+		return NULL;
+	}
+	mi->mi_setx++;
+
+	/* If next header is identical, return it now. */
+	if (mi->mi_prevoffset && mi->mi_offset == mi->mi_prevoffset)
+	    return mi->mi_h;
+
+	if ((h = rpmdbsumHeader(sum, mi->mi_offset)) == NULL)
+	    continue;
+	headerSetInstance(h, mi->mi_offset);
+
+	miFreeHeader(mi, NULL);
+	mi->mi_h = h;
+
+	if (mireSkip(mi, mi->mi_h))
+	    continue;
+
+	mi->mi_prevoffset = mi->mi_offset;
+	mi->mi_modified = 0;
+	return mi->mi_h;
+    }
+    return NULL;
+}
+
 /* FIX: mi->mi_key.data may be NULL */
 Header rpmdbNextIterator(rpmdbMatchIterator mi)
 {
     dbiIndex dbi = NULL;
+    Header cached;
     unsigned char * uh;
     unsigned int uhlen;
     int rc;
-    headerImportFlags importFlags = HEADERIMPORT_FAST;
+    headerImportFlags importFlags = HEADERIMPORT_FAST | HEADERIMPORT_LAZY;
 
     if (mi == NULL)
 	return NULL;
@@ -1424,8 +2066,23 @@ Header rpmdbNextIterator(rpmdbMatchIterator mi)
      * iterator on 1st call. If the iteration is to rewrite headers,
      * then the cursor needs to marked with DBC_WRITE as well.
      */
-    if (mi->mi_dbc == NULL)
+    if (mi->mi_dbc == NULL) {
+	/* Let the indexes do the selecting on full scans where possible */
+	if (mi->mi_set == NULL && mi->mi_nre > 0 &&
+	    mi->mi_rpmtag == RPMDBI_PACKAGES)
+	    miPushdown(mi);
 	mi->mi_dbc = dbiCursorInit(dbi, mi->mi_cflags);
+	/* Read-only full scans decode ahead on all cores */
+	if (mi->mi_set == NULL && !(mi->mi_cflags & DBC_WRITE) &&
+	    !mi->mi_summary)
+	    mi->mi_pfsize = rpmExpandNumeric("%{?_db_prefetch}");
+    }
+
+    if (mi->mi_summary)
+	return miNextSummary(mi);
+
+    if (mi->mi_pfsize > 0)
+	return miNextPrefetched(mi, dbi);
 
 top:
     uh = NULL;
@@ -1453,6 +2110,17 @@ top:
     if (mi->mi_prevoffset && mi->mi_offset == mi->mi_prevoffset)
 	return mi->mi_h;
 
+    /* Reuse a header blob loaded by an earlier iteration if we can. */
+    cached = miCachedHeader(mi, importFlags);
+    if (cached) {
+	pkgdbRelease(dbi, mi->mi_dbc);
+	miFreeHeader(mi, dbi);
+	mi->mi_h = cached;
+	goto match;
+    }
+
+    rpmswEnter(&mi->mi_db->db_hdrloadops, 0);
+
     /* Retrieve next header blob for index iterator. */
     if (uh == NULL) {
 	rc = pkgdbGet(dbi, mi->mi_dbc, mi->mi_offset, &uh, &uhlen);
@@ -1474,20 +2142,29 @@ top:
 
     /* Did the header blob load correctly? */
     mi->mi_h = headerImport(uh, uhlen, importFlags);
+    /* Import left the blob as is if it copied it, the cache can keep it */
+    if (mi->mi_h && headerIsEntry(mi->mi_h, RPMTAG_NAME) &&
+	(importFlags & HEADERIMPORT_COPY) && miCacheable(mi))
+	hdrCachePut(mi->mi_db->db_hdrcache, mi->mi_offset, uh, uhlen);
+    /* The header has a copy of the blob now, let the backend drop it */
+    if (importFlags & HEADERIMPORT_COPY)
+	pkgdbRelease(dbi, mi->mi_dbc);
     if (mi->mi_h == NULL || !headerIsEntry(mi->mi_h, RPMTAG_NAME)) {
 	rpmlog(RPMLOG_ERR,
 		_("rpmdb: damaged header #%u retrieved -- skipping.\n"),
 		mi->mi_offset);
 	goto top;
     }
+    headerSetInstance(mi->mi_h, mi->mi_offset);
+    rpmswExit(&mi->mi_db->db_hdrloadops, uhlen);
 
+match:
     /*
      * Skip this header if iterator selector (if any) doesn't match.
      */
-    if (mireSkip(mi)) {
+    if (mireSkip(mi, mi->mi_h)) {
 	goto top;
     }
-    headerSetInstance(mi->mi_h, mi->mi_offset);
 
     mi->mi_prevoffset = mi->mi_offset;
     mi->mi_modified = 0;
@@ -1508,6 +2185,82 @@ void rpmdbSortIterator(rpmdbMatchIterator mi)
     }
 }
 
+struct idxKey_s {
+    const char *key;
+    size_t keylen;
+};
+
+static int idxKeyCmp(const void *a, const void *b)
+{
+    const struct idxKey_s *ka = a, *kb = b;
+    return idxdbKeyCmp(ka->key, ka->keylen, kb->key, kb->keylen);
+}
+
+int rpmdbExtendIteratorMany(rpmdbMatchIterator mi, const char **keys,
+			    const size_t *keylens, int nkeys)
+{
+    dbiIndex dbi = NULL;
+    struct idxKey_s *ik;
+    const char **skeys;
+    size_t *skeylens;
+    dbiIndexSet *sets;
+    int n = 0;
+    int rc = 1; /* assume failure */
+
+    if (mi == NULL || keys == NULL || nkeys <= 0)
+	return rc;
+
+    if (indexOpen(mi->mi_db, mi->mi_rpmtag, 0, &dbi))
+	return rc;
+
+    /* The backends want the keys sorted and unique */
+    ik = xmalloc(nkeys * sizeof(*ik));
+    for (int i = 0; i < nkeys; i++) {
+	ik[i].key = keys[i];
+	ik[i].keylen = keylens[i] ? keylens[i] : strlen(keys[i]);
+    }
+    qsort(ik, nkeys, sizeof(*ik), idxKeyCmp);
+
+    skeys = xmalloc(nkeys * sizeof(*skeys));
+    skeylens = xmalloc(nkeys * sizeof(*skeylens));
+    for (int i = 0; i < nkeys; i++) {
+	if (n && idxKeyCmp(&ik[i], &ik[i-1]) == 0)
+	    continue;
+	skeys[n] = ik[i].key;
+	skeylens[n] = ik[i].keylen;
+	n++;
+    }
+    sets = xcalloc(n, sizeof(*sets));
+
+    if (dbi != NULL) {
+	dbiCursor dbc = dbiCursorInit(dbi, DBC_READ);
+	if (idxdbGetMany(dbi, dbc, skeys, skeylens, n, sets) == RPMRC_OK)
+	    rc = 0;
+	dbiCursorFree(dbi, dbc);
+    }
+
+    for (int i = 0; i < n; i++) {
+	if (sets[i] == NULL)
+	    continue;
+	if (rc == 0) {
+	    if (mi->mi_set == NULL) {
+		mi->mi_set = sets[i];
+		sets[i] = NULL;
+	    } else {
+		dbiIndexSetAppendSet(mi->mi_set, sets[i], 0);
+	    }
+	    mi->mi_sorted = 0;
+	}
+	dbiIndexSetFree(sets[i]);
+    }
+
+    free(sets);
+    free(skeylens);
+    free(skeys);
+    free(ik);
+    return rc;
+}
+
 void rpmdbUniqIterator(rpmdbMatchIterator mi)
 {
     if (mi && mi->mi_set) {
@@ -1983,6 +2736,7 @@ int rpmdbRemove(rpmdb db, unsigned int hdrNum)
     if (db == NULL)
 	return 0;
 
+    (void) dbSummary(db);
     h = rpmdbGetHeaderAt(db, hdrNum);
 
     if (h == NULL) {
@@ -2005,6 +2759,7 @@ int rpmdbRemove(rpmdb db, unsigned int hdrNum)
     dbc = dbiCursorInit(dbi, DBC_WRITE);
     ret = pkgdbDel(dbi, dbc, hdrNum);
     dbiCursorFree(dbi, dbc);
+    hdrCacheDel(db->db_hdrcache, hdrNum);
 
     /* Remove associated data from secondary indexes */
     if (ret == 0) {
@@ -2022,6 +2777,7 @@ int rpmdbRemove(rpmdb db, unsigned int hdrNum)
     dbCtrl(db, DB_CTRL_UNLOCK_RW);
     rpmsqBlock(SIG_UNBLOCK);
 
+    dbSummaryUpdate(db, hdrNum, NULL, 0, (ret == 0));
     headerFree(h);
 
     /* XXX return ret; */
@@ -2241,6 +2997,8 @@ int rpmdbAdd(rpmdb db, Header h)
     ret = pkgdbOpen(db, 0, &dbi);
     if (ret)
 	goto exit;
+
+    (void) dbSummary(db);
 	
     rpmsqBlock(SIG_BLOCK);
     dbCtrl(db, DB_CTRL_LOCK_RW);
@@ -2249,6 +3007,7 @@ int rpmdbAdd(rpmdb db, Header h)
     dbc = dbiCursorInit(dbi, DBC_WRITE);
     ret = pkgdbPut(dbi, dbc, &hdrNum, hdrBlob, hdrLen);
     dbiCursorFree(dbi, dbc);
+    hdrCacheDel(db->db_hdrcache, hdrNum);
 
     /* Add associated data to secondary indexes */
     if (ret == 0) {	
@@ -2266,6 +3025,8 @@ int rpmdbAdd(rpmdb db, Header h)
     dbCtrl(db, DB_CTRL_UNLOCK_RW);
     rpmsqBlock(SIG_UNBLOCK);
 
+    dbSummaryUpdate(db, hdrNum, hdrBlob, hdrLen, (ret == 0));
+
     /* If everything ok, mark header as installed now */
     if (ret == 0) {
 	headerSetInstance(h, hdrNum);
@@ -2404,6 +3165,129 @@ static int rpmdbSetPermissions(char * src, char * dest)
     return rc;
 }
 
+/* No. of headers read from the old database at a time on rebuild */
+#define REBUILD_BATCH 256
+
+struct rebuildItem_s {
+    unsigned int offset;	/*!< header instance in the old database */
+    unsigned char *blob;	/*!< header blob, until imported */
+    unsigned int bloblen;
+    Header h;			/*!< header to add, NULL to skip */
+    rpmRC chkrc;		/*!< header check result */
+    int checked;		/*!< was the header checked? */
+    int damaged;		/*!< did the header fail to import? */
+    int bad;			/*!< does the header lack required tags? */
+    char *msg;			/*!< header check message */
+};
+
+/* Read the next batch of header blobs, returns the number read */
+static int rebuildRead(dbiIndex dbi, dbiCursor dbc,
+			struct rebuildItem_s *items, unsigned int *nread)
+{
+    unsigned char *uh = NULL;
+    unsigned int uhlen = 0;
+    int n = 0;
+
+    while (dbc && n < REBUILD_BATCH) {
+	if (pkgdbGet(dbi, dbc, 0, &uh, &uhlen) || uh == NULL)
+	    break;
+	unsigned int offset = pkgdbKey(dbi, dbc);
+
+	/* Terminate on end of keys, as rpmdbNextIterator() does */
+	if (offset == 0) {
+	    if (*nread)
+		break;
+	    continue;
+	}
+	(*nread)++;
+
+	/* The blob is only valid until the next cursor access */
+	memset(&items[n], 0, sizeof(items[n]));
+	items[n].offset = offset;
+	items[n].blob = memcpy(xmalloc(uhlen), uh, uhlen);
+	items[n].bloblen = uhlen;
+	n++;
+    }
+    if (dbc)
+	pkgdbRelease(dbi, dbc);
+    return n;
+}
+
+/*
+ * Verify, import and sanity check a header read for rebuild. Called from
+ * worker threads, the results are reported by rebuildReport().
+ */
+static void rebuildPrepare(struct rebuildItem_s *item, rpmts ts,
+		rpmRC (*hdrchk) (rpmts ts, const void *uh, size_t uc, char ** msg))
+{
+    Header h = NULL;
+
+    /* Verify header if enabled, skip damaged and inconsistent headers */
+    if (ts && hdrchk) {
+	item->chkrc = (*hdrchk) (ts, item->blob, item->bloblen, &item->msg);
+	item->checked = 1;
+	if (item->chkrc == RPMRC_FAIL)
+	    goto exit;
+    }
+
+    /*
+     * Decode it all here rather than lazily in the writer, and keep the
+     * blob so rpmdbAdd() gets to export it by a plain copy.
+     */
+    h = headerImport(item->blob, item->bloblen,
+		     HEADERIMPORT_FAST | HEADERIMPORT_KEEP);
+    if (h == NULL) {
+	item->damaged = 1;
+	goto exit;
+    }
+    /* The header owns the blob now */
+    item->blob = NULL;
+
+    /* let's sanity check this record a bit, otherwise just skip it */
+    if (!(headerIsEntry(h, RPMTAG_NAME) &&
+	headerIsEntry(h, RPMTAG_VERSION) &&
+	headerIsEntry(h, RPMTAG_RELEASE) &&
+	headerIsEntry(h, RPMTAG_BUILDTIME)))
+    {
+	item->bad = 1;
+	h = headerFree(h);
+	goto exit;
+    }
+
+    /* Deleted entries are eliminated in legacy headers by copy. */
+    if (headerIsEntry(h, RPMTAG_HEADERIMAGE)) {
+	Header nh = headerReload(headerCopy(h), RPMTAG_HEADERIMAGE);
+	headerFree(h);
+	h = nh;
+    }
+
+exit:
+    item->h = h;
+    item->blob = _free(item->blob);
+}
+
+/* Log the outcome of rebuildPrepare(), in database order */
+static void rebuildReport(struct rebuildItem_s *item)
+{
+    if (item->checked) {
+	int lvl = (item->chkrc == RPMRC_FAIL ? RPMLOG_ERR : RPMLOG_DEBUG);
+	rpmlog(lvl, "%s h#%8u %s\n",
+	    (item->chkrc == RPMRC_FAIL ? _("rpmdbRebuild: skipping") : " read"),
+		    item->offset, (item->msg ? item->msg : ""));
+	item->msg = _free(item->msg);
+    }
+    if (item->damaged) {
+	rpmlog(RPMLOG_ERR,
+		_("rpmdb: damaged header #%u retrieved -- skipping.\n"),
+		item->offset);
+    }
+    if (item->bad) {
+	rpmlog(RPMLOG_ERR,
+		_("header #%u in the database is bad -- skipping.\n"),
+		item->offset);
+    }
+}
+
 int rpmdbRebuild(const char * prefix, rpmts ts,
 		rpmRC (*hdrchk) (rpmts ts, const void *uh, size_t uc, char ** msg),
 		int rebuildflags)
@@ -2458,46 +3342,53 @@ int rpmdbRebuild(const char * prefix, rpmts ts,
 	goto exit;
     }
 
-    {	Header h = NULL;
-	rpmdbMatchIterator mi;
-
-	mi = rpmdbInitIterator(olddb, RPMDBI_PACKAGES, NULL, 0);
-	if (ts && hdrchk)
-	    (void) rpmdbSetHdrChk(mi, ts, hdrchk);
+    /* The new database starts out empty, and so does its summary */
+    if (rpmExpandNumeric("%{?_db_summary}") > 0) {
+	newdb->db_summary = rpmdbsumNew();
+	newdb->db_sumstate = SUMMARY_DIRTY;
+    }
 
-	while ((h = rpmdbNextIterator(mi)) != NULL) {
+    {	struct rebuildItem_s *items = xcalloc(REBUILD_BATCH, sizeof(*items));
+	dbiIndex dbi = NULL;
+	dbiCursor dbc = NULL;
+	unsigned int nread = 0;
+	/* Only our own checker is known to be safe to call concurrently */
+	int parallel = (hdrchk == NULL || hdrchk == headerCheck);
+	int n;
 
-	    /* let's sanity check this record a bit, otherwise just skip it */
-	    if (!(headerIsEntry(h, RPMTAG_NAME) &&
-		headerIsEntry(h, RPMTAG_VERSION) &&
-		headerIsEntry(h, RPMTAG_RELEASE) &&
-		headerIsEntry(h, RPMTAG_BUILDTIME)))
-	    {
-		rpmlog(RPMLOG_ERR,
-			_("header #%u in the database is bad -- skipping.\n"),
-			rpmdbGetIteratorOffset(mi));
-		continue;
-	    }
+	/* Load the keyring now, not racing from the checking threads */
+	if (ts && hdrchk)
+	    rpmKeyringFree(rpmtsGetKeyring(ts, 1));
 
-	    /* Deleted entries are eliminated in legacy headers by copy. */
-	    if (headerIsEntry(h, RPMTAG_HEADERIMAGE)) {
-		Header nh = headerReload(headerCopy(h), RPMTAG_HEADERIMAGE);
-		rc = rpmdbAdd(newdb, nh);
-		headerFree(nh);
-	    } else {
-		rc = rpmdbAdd(newdb, h);
-	    }
+	if (pkgdbOpen(olddb, 0, &dbi) == 0)
+	    dbc = dbiCursorInit(dbi, 0);
 
-	    if (rc) {
-		rpmlog(RPMLOG_ERR, _("cannot add record originally at %u\n"),
-		       rpmdbGetIteratorOffset(mi));
-		failed = 1;
-		break;
+	do {
+	    n = rebuildRead(dbi, dbc, items, &nread);
+
+	    /* Checking and importing is independent per header */
+	    #pragma omp parallel for schedule(dynamic) if (parallel)
+	    for (int i = 0; i < n; i++)
+		rebuildPrepare(&items[i], ts, hdrchk);
+
+	    /* ...but the new database has a single writer */
+	    for (int i = 0; i < n; i++) {
+		rebuildReport(&items[i]);
+		if (items[i].h && !failed) {
+		    rc = rpmdbAdd(newdb, items[i].h);
+		    if (rc) {
+			rpmlog(RPMLOG_ERR,
+				_("cannot add record originally at %u\n"),
+				items[i].offset);
+			failed = 1;
+		    }
+		}
+		items[i].h = headerFree(items[i].h);
 	    }
-	}
-
-	rpmdbFreeIterator(mi);
+	} while (n == REBUILD_BATCH && !failed);
 
+	dbiCursorFree(dbi, dbc);
+	free(items);
     }
 
     rpmdbClose(olddb);
@@ -119,6 +119,33 @@ const char *rpmdbHome(rpmdb db);
 int rpmdbExtendIterator(rpmdbMatchIterator mi,
 			const void * keyp, size_t keylen);
 
+/** \ingroup rpmdb
+ * Add the matches of several keys to a database iterator, using a single
+ * batched index lookup.
+ * @param mi		rpm database iterator
+ * @param keys		array of keys (in any order, duplicates allowed)
+ * @param keylens	array of key lengths (0 will use strlen(key))
+ * @param nkeys		number of keys
+ * @return		0 if any key matched
+ */
+RPM_GNUC_INTERNAL
+int rpmdbExtendIteratorMany(rpmdbMatchIterator mi, const char **keys,
+			    const size_t *keylens, int nkeys);
+
+/** \ingroup rpmdb
+ * Declare the header tags an iteration is going to look at. If the package
+ * summary covers all of them and the selectors set up so far, the iterator
+ * returns headers holding just the summary tags instead of loading the
+ * package headers. Call before the first rpmdbNextIterator().
+ * @param mi		rpm database iterator
+ * @param tags		array of tags (and extensions)
+ * @param ntags		number of tags
+ * @return		1 if summary headers are returned, 0 otherwise
+ */
+RPM_GNUC_INTERNAL
+int rpmdbSetIteratorTags(rpmdbMatchIterator mi,
+			 const rpmTagVal *tags, int ntags);
+
 /** \ingroup rpmdb
  * sort the iterator by (recnum, filenum)
  * Return database iterator.
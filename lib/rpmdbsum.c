@@ -0,0 +1,476 @@
+/** \ingroup rpmdb
+ * \file lib/rpmdbsum.c
+ * Package summary table.
+ *
+ * The summary file consists of a fixed-size header, a table of fixed-width
+ * per-package records sorted by header instance and an area of NUL
+ * terminated strings the records point into by offset. It is written with
+ * the cookie of the database contents it describes and ignored when that
+ * no longer matches, so a summary left behind by a crash or by a database
+ * change from a tool not maintaining it can never be served.
+ */
+
+#include "system.h"
+
+#include <errno.h>
+#include <fcntl.h>
+
+#include <rpm/header.h>
+#include <rpm/rpmlog.h>
+#include <rpm/rpmstring.h>
+
+#include "lib/rpmdbsum.h"
+#include "debug.h"
+
+#define SUMFILE_MAGIC	"RPMDBSUM"
+#define SUMFILE_VERSION	1
+#define SUMFILE_ORDER	0x01020304
+
+struct sumFileHdr_s {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteorder;		/*!< native order of the writer */
+    uint32_t recsize;		/*!< size of a record */
+    uint32_t nrecs;		/*!< no. of records */
+    uint32_t strsize;		/*!< size of the string area */
+    uint32_t cookie;		/*!< database cookie (string offset) */
+};
+
+enum sumFlags_e {
+    SUM_NAME		= (1 << 0),
+    SUM_VERSION		= (1 << 1),
+    SUM_RELEASE		= (1 << 2),
+    SUM_ARCH		= (1 << 3),
+    SUM_VENDOR		= (1 << 4),
+    SUM_SOURCERPM	= (1 << 5),
+    SUM_EPOCH		= (1 << 6),
+    SUM_INSTALLTIME	= (1 << 7),
+    SUM_SIZE		= (1 << 8),
+    SUM_LONGSIZE	= (1 << 9),
+    SUM_SIGMD5		= (1 << 10),
+    SUM_NOSRC		= (1 << 11),	/*!< source header with NOSOURCE/NOPATCH */
+};
+
+/* Per-package record, string members are offsets into the string area */
+struct sumRec_s {
+    uint32_t hdrNum;		/*!< header instance */
+    uint32_t flags;		/*!< tags present in the header */
+    uint32_t name;
+    uint32_t version;
+    uint32_t release;
+    uint32_t arch;
+    uint32_t vendor;
+    uint32_t sourcerpm;
+    uint32_t epoch;
+    uint32_t installtime;
+    uint32_t size;
+    uint32_t reserved;
+    uint64_t longsize;
+    uint8_t sigmd5[16];
+};
+
+struct rpmdbsum_s {
+    struct sumRec_s *recs;	/*!< records, sorted by header instance */
+    int nrecs;
+    int arecs;
+    char *strs;			/*!< string area, starts with "" */
+    size_t strsize;
+    size_t astrs;
+};
+
+rpmdbsum rpmdbsumNew(void)
+{
+    rpmdbsum sum = xcalloc(1, sizeof(*sum));
+    sum->astrs = 4096;
+    sum->strs = xmalloc(sum->astrs);
+    sum->strs[0] = '\0';
+    sum->strsize = 1;
+    return sum;
+}
+
+rpmdbsum rpmdbsumFree(rpmdbsum sum)
+{
+    if (sum) {
+	free(sum->recs);
+	free(sum->strs);
+	free(sum);
+    }
+    return NULL;
+}
+
+static uint32_t sumAddString(rpmdbsum sum, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    uint32_t off;
+
+    if (len == 1)
+	return 0;
+    if (sum->strsize + len > sum->astrs) {
+	while (sum->strsize + len > sum->astrs)
+	    sum->astrs *= 2;
+	sum->strs = xrealloc(sum->strs, sum->astrs);
+    }
+    off = sum->strsize;
+    memcpy(sum->strs + off, s, len);
+    sum->strsize += len;
+    return off;
+}
+
+/* Index of the first record not below hdrNum */
+static int sumFind(rpmdbsum sum, unsigned int hdrNum)
+{
+    int lo = 0, hi = sum->nrecs;
+
+    while (lo < hi) {
+	int mid = lo + (hi - lo) / 2;
+	if (sum->recs[mid].hdrNum < hdrNum)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo;
+}
+
+static uint32_t sumGetString(rpmdbsum sum, Header h, rpmTagVal tag,
+			     uint32_t *flags, uint32_t flag)
+{
+    const char *s = headerGetString(h, tag);
+    if (s == NULL)
+	return 0;
+    *flags |= flag;
+    return sumAddString(sum, s);
+}
+
+static uint32_t sumGetUint32(Header h, rpmTagVal tag,
+			     uint32_t *flags, uint32_t flag)
+{
+    struct rpmtd_s td;
+    uint32_t val = 0;
+
+    if (headerGet(h, tag, &td, HEADERGET_MINMEM)) {
+	if (rpmtdType(&td) == RPM_INT32_TYPE && rpmtdCount(&td) == 1) {
+	    val = *rpmtdNextUint32(&td);
+	    *flags |= flag;
+	}
+	rpmtdFreeData(&td);
+    }
+    return val;
+}
+
+void rpmdbsumAdd(rpmdbsum sum, unsigned int hdrNum, Header h)
+{
+    struct sumRec_s rec;
+    struct rpmtd_s td;
+    int i;
+
+    if (sum == NULL || hdrNum == 0 || h == NULL)
+	return;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.hdrNum = hdrNum;
+    rec.name = sumGetString(sum, h, RPMTAG_NAME, &rec.flags, SUM_NAME);
+    rec.version = sumGetString(sum, h, RPMTAG_VERSION, &rec.flags, SUM_VERSION);
+    rec.release = sumGetString(sum, h, RPMTAG_RELEASE, &rec.flags, SUM_RELEASE);
+    rec.arch = sumGetString(sum, h, RPMTAG_ARCH, &rec.flags, SUM_ARCH);
+    rec.vendor = sumGetString(sum, h, RPMTAG_VENDOR, &rec.flags, SUM_VENDOR);
+    rec.sourcerpm = sumGetString(sum, h, RPMTAG_SOURCERPM,
+				 &rec.flags, SUM_SOURCERPM);
+    rec.epoch = sumGetUint32(h, RPMTAG_EPOCH, &rec.flags, SUM_EPOCH);
+    rec.installtime = sumGetUint32(h, RPMTAG_INSTALLTIME,
+				   &rec.flags, SUM_INSTALLTIME);
+    rec.size = sumGetUint32(h, RPMTAG_SIZE, &rec.flags, SUM_SIZE);
+
+    if (headerGet(h, RPMTAG_LONGSIZE, &td, HEADERGET_MINMEM)) {
+	if (rpmtdType(&td) == RPM_INT64_TYPE && rpmtdCount(&td) == 1) {
+	    rec.longsize = *rpmtdNextUint64(&td);
+	    rec.flags |= SUM_LONGSIZE;
+	}
+	rpmtdFreeData(&td);
+    }
+    if (headerIsSource(h) && (headerIsEntry(h, RPMTAG_NOSOURCE) ||
+			      headerIsEntry(h, RPMTAG_NOPATCH)))
+	rec.flags |= SUM_NOSRC;
+    if (headerGet(h, RPMTAG_SIGMD5, &td, HEADERGET_MINMEM)) {
+	if (rpmtdType(&td) == RPM_BIN_TYPE &&
+		rpmtdCount(&td) == sizeof(rec.sigmd5)) {
+	    memcpy(rec.sigmd5, td.data, sizeof(rec.sigmd5));
+	    rec.flags |= SUM_SIGMD5;
+	}
+	rpmtdFreeData(&td);
+    }
+
+    i = sumFind(sum, hdrNum);
+    if (!(i < sum->nrecs && sum->recs[i].hdrNum == hdrNum)) {
+	if (sum->nrecs == sum->arecs) {
+	    sum->arecs = sum->arecs ? sum->arecs * 2 : 256;
+	    sum->recs = xrealloc(sum->recs, sum->arecs * sizeof(*sum->recs));
+	}
+	memmove(sum->recs + i + 1, sum->recs + i,
+		(sum->nrecs - i) * sizeof(*sum->recs));
+	sum->nrecs++;
+    }
+    sum->recs[i] = rec;
+}
+
+void rpmdbsumDel(rpmdbsum sum, unsigned int hdrNum)
+{
+    int i;
+
+    if (sum == NULL)
+	return;
+
+    i = sumFind(sum, hdrNum);
+    if (i < sum->nrecs && sum->recs[i].hdrNum == hdrNum) {
+	memmove(sum->recs + i, sum->recs + i + 1,
+		(sum->nrecs - i - 1) * sizeof(*sum->recs));
+	sum->nrecs--;
+    }
+}
+
+unsigned int rpmdbsumNext(rpmdbsum sum, unsigned int hdrNum)
+{
+    int i;
+
+    if (sum == NULL || hdrNum == UINT_MAX)
+	return 0;
+
+    i = sumFind(sum, hdrNum + 1);
+    return (i < sum->nrecs) ? sum->recs[i].hdrNum : 0;
+}
+
+Header rpmdbsumHeader(rpmdbsum sum, unsigned int hdrNum)
+{
+    struct sumRec_s *rec;
+    Header h;
+    int i;
+
+    if (sum == NULL)
+	return NULL;
+
+    i = sumFind(sum, hdrNum);
+    if (!(i < sum->nrecs && sum->recs[i].hdrNum == hdrNum))
+	return NULL;
+    rec = &sum->recs[i];
+
+    h = headerNew();
+    if (rec->flags & SUM_NAME)
+	headerPutString(h, RPMTAG_NAME, sum->strs + rec->name);
+    if (rec->flags & SUM_VERSION)
+	headerPutString(h, RPMTAG_VERSION, sum->strs + rec->version);
+    if (rec->flags & SUM_RELEASE)
+	headerPutString(h, RPMTAG_RELEASE, sum->strs + rec->release);
+    if (rec->flags & SUM_ARCH)
+	headerPutString(h, RPMTAG_ARCH, sum->strs + rec->arch);
+    if (rec->flags & SUM_VENDOR)
+	headerPutString(h, RPMTAG_VENDOR, sum->strs + rec->vendor);
+    if (rec->flags & SUM_SOURCERPM)
+	headerPutString(h, RPMTAG_SOURCERPM, sum->strs + rec->sourcerpm);
+    if (rec->flags & SUM_EPOCH)
+	headerPutUint32(h, RPMTAG_EPOCH, &rec->epoch, 1);
+    if (rec->flags & SUM_INSTALLTIME)
+	headerPutUint32(h, RPMTAG_INSTALLTIME, &rec->installtime, 1);
+    if (rec->flags & SUM_SIZE)
+	headerPutUint32(h, RPMTAG_SIZE, &rec->size, 1);
+    if (rec->flags & SUM_LONGSIZE)
+	headerPutUint64(h, RPMTAG_LONGSIZE, &rec->longsize, 1);
+    if (rec->flags & SUM_SIGMD5)
+	headerPutBin(h, RPMTAG_SIGMD5, rec->sigmd5, sizeof(rec->sigmd5));
+
+    return h;
+}
+
+int rpmdbsumCovers(rpmdbsum sum, rpmTagVal tag)
+{
+    switch (tag) {
+    case RPMTAG_ARCHSUFFIX:
+	/* Summary headers lack the tags telling "nosrc" from "src" */
+	for (int i = 0; sum && i < sum->nrecs; i++) {
+	    if (sum->recs[i].flags & SUM_NOSRC)
+		return 0;
+	}
+	return 1;
+    case RPMTAG_NAME:
+    case RPMTAG_VERSION:
+    case RPMTAG_RELEASE:
+    case RPMTAG_ARCH:
+    case RPMTAG_VENDOR:
+    case RPMTAG_SOURCERPM:
+    case RPMTAG_EPOCH:
+    case RPMTAG_INSTALLTIME:
+    case RPMTAG_SIZE:
+    case RPMTAG_LONGSIZE:
+    case RPMTAG_SIGMD5:
+    /* extensions computed from the above only */
+    case RPMTAG_EPOCHNUM:
+    case RPMTAG_EVR:
+    case RPMTAG_NVR:
+    case RPMTAG_NEVR:
+    case RPMTAG_NVRA:
+    case RPMTAG_NEVRA:
+    case RPMTAG_DBINSTANCE:
+	return 1;
+    default:
+	return 0;
+    }
+}
+
+static int sumRecValid(const struct sumRec_s *rec, size_t strsize)
+{
+    return (rec->name < strsize && rec->version < strsize &&
+	    rec->release < strsize && rec->arch < strsize &&
+	    rec->vendor < strsize && rec->sourcerpm < strsize);
+}
+
+rpmdbsum rpmdbsumRead(const char *path, const char *cookie)
+{
+    struct sumFileHdr_s hdr;
+    rpmdbsum sum = NULL;
+    char *buf = NULL;
+    struct stat sb;
+    size_t size, recsize;
+    ssize_t nb;
+    int fd;
+
+    if (path == NULL || cookie == NULL)
+	return NULL;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+	return NULL;
+
+    if (fstat(fd, &sb) || sb.st_size < (off_t) sizeof(hdr))
+	goto exit;
+    size = sb.st_size;
+    buf = xmalloc(size);
+    nb = read(fd, buf, size);
+    if (nb < 0 || (size_t) nb != size)
+	goto exit;
+
+    memcpy(&hdr, buf, sizeof(hdr));
+    if (memcmp(hdr.magic, SUMFILE_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.version != SUMFILE_VERSION ||
+	    hdr.byteorder != SUMFILE_ORDER ||
+	    hdr.recsize != sizeof(struct sumRec_s))
+	goto exit;
+
+    recsize = (size_t) hdr.nrecs * hdr.recsize;
+    if (hdr.strsize == 0 || size - sizeof(hdr) < recsize ||
+	    size - sizeof(hdr) - recsize != hdr.strsize)
+	goto exit;
+
+    sum = xcalloc(1, sizeof(*sum));
+    sum->nrecs = sum->arecs = hdr.nrecs;
+    sum->recs = xmalloc((hdr.nrecs ? hdr.nrecs : 1) * sizeof(*sum->recs));
+    memcpy(sum->recs, buf + sizeof(hdr), recsize);
+    sum->strsize = sum->astrs = hdr.strsize;
+    sum->strs = xmalloc(hdr.strsize);
+    memcpy(sum->strs, buf + sizeof(hdr) + recsize, hdr.strsize);
+
+    /* All strings must be terminated within the area, records in order */
+    if (sum->strs[0] != '\0' || sum->strs[sum->strsize - 1] != '\0' ||
+	    hdr.cookie >= sum->strsize)
+	goto err;
+    for (int i = 0; i < sum->nrecs; i++) {
+	if (!sumRecValid(&sum->recs[i], sum->strsize))
+	    goto err;
+	if (sum->recs[i].hdrNum == 0 ||
+		(i > 0 && sum->recs[i].hdrNum <= sum->recs[i-1].hdrNum))
+	    goto err;
+    }
+
+    if (!rstreq(sum->strs + hdr.cookie, cookie)) {
+	rpmlog(RPMLOG_DEBUG, "package summary %s is stale\n", path);
+	sum = rpmdbsumFree(sum);
+    }
+
+exit:
+    free(buf);
+    close(fd);
+    return sum;
+
+err:
+    rpmlog(RPMLOG_WARNING, _("ignoring damaged package summary %s\n"), path);
+    sum = rpmdbsumFree(sum);
+    goto exit;
+}
+
+static int writeAll(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0) {
+	ssize_t nb = write(fd, p, len);
+	if (nb < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return -1;
+	}
+	p += nb;
+	len -= nb;
+    }
+    return 0;
+}
+
+int rpmdbsumWrite(rpmdbsum sum, const char *path, const char *cookie,
+		  int perms)
+{
+    struct sumFileHdr_s hdr;
+    rpmdbsum out;
+    char *tmppath = NULL;
+    int rc = -1;
+    int fd;
+
+    if (sum == NULL || path == NULL || cookie == NULL)
+	return -1;
+
+    /* Write a compacted copy, replaced strings linger in the original */
+    out = rpmdbsumNew();
+    out->nrecs = out->arecs = sum->nrecs;
+    out->recs = xmalloc((sum->nrecs ? sum->nrecs : 1) * sizeof(*out->recs));
+    for (int i = 0; i < sum->nrecs; i++) {
+	struct sumRec_s *src = &sum->recs[i], *dst = &out->recs[i];
+	*dst = *src;
+	dst->name = sumAddString(out, sum->strs + src->name);
+	dst->version = sumAddString(out, sum->strs + src->version);
+	dst->release = sumAddString(out, sum->strs + src->release);
+	dst->arch = sumAddString(out, sum->strs + src->arch);
+	dst->vendor = sumAddString(out, sum->strs + src->vendor);
+	dst->sourcerpm = sumAddString(out, sum->strs + src->sourcerpm);
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SUMFILE_MAGIC, sizeof(hdr.magic));
+    hdr.version = SUMFILE_VERSION;
+    hdr.byteorder = SUMFILE_ORDER;
+    hdr.recsize = sizeof(struct sumRec_s);
+    hdr.nrecs = out->nrecs;
+    hdr.cookie = out->strsize;
+    sumAddString(out, cookie);
+    hdr.strsize = out->strsize;
+
+    rasprintf(&tmppath, "%s.%d", path, (int) getpid());
+    fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, perms);
+    if (fd < 0)
+	goto exit;
+
+    if (writeAll(fd, &hdr, sizeof(hdr)) == 0 &&
+	writeAll(fd, out->recs, out->nrecs * sizeof(*out->recs)) == 0 &&
+	writeAll(fd, out->strs, out->strsize) == 0 &&
+	fsync(fd) == 0)
+	rc = 0;
+
+    if (close(fd))
+	rc = -1;
+    if (rc == 0)
+	rc = rename(tmppath, path);
+
+exit:
+    if (rc) {
+	rpmlog(RPMLOG_WARNING, _("cannot write package summary %s: %s\n"),
+	       path, strerror(errno));
+	if (fd >= 0)
+	    unlink(tmppath);
+    }
+    free(tmppath);
+    rpmdbsumFree(out);
+    return rc;
+}
@@ -0,0 +1,107 @@
+#ifndef H_RPMDBSUM
+#define H_RPMDBSUM
+
+/** \ingroup rpmdb
+ * \file rpmdbsum.h
+ * Package summary table: a compact copy of the few header tags most
+ * queries look at, kept beside the database so such queries can be
+ * answered without loading and importing full headers.
+ */
+
+#include <rpm/rpmtypes.h>
+
+/**
+ */
+typedef struct rpmdbsum_s * rpmdbsum;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Create an empty package summary.
+ * @return		new package summary
+ */
+RPM_GNUC_INTERNAL
+rpmdbsum rpmdbsumNew(void);
+
+/**
+ * Destroy a package summary.
+ * @param sum		package summary
+ * @return		NULL always
+ */
+RPM_GNUC_INTERNAL
+rpmdbsum rpmdbsumFree(rpmdbsum sum);
+
+/**
+ * Read a package summary from a file.
+ * @param path		summary file path
+ * @param cookie	database cookie the summary must have been written for
+ * @return		package summary, NULL if missing, damaged or stale
+ */
+RPM_GNUC_INTERNAL
+rpmdbsum rpmdbsumRead(const char *path, const char *cookie);
+
+/**
+ * Write a package summary to a file, atomically replacing the old one.
+ * @param sum		package summary
+ * @param path		summary file path
+ * @param cookie	database cookie matching the summary contents
+ * @param perms		file permissions
+ * @return		0 on success
+ */
+RPM_GNUC_INTERNAL
+int rpmdbsumWrite(rpmdbsum sum, const char *path, const char *cookie,
+		  int perms);
+
+/**
+ * Add (or replace) the summary of a package.
+ * @param sum		package summary
+ * @param hdrNum	header instance
+ * @param h		package header
+ */
+RPM_GNUC_INTERNAL
+void rpmdbsumAdd(rpmdbsum sum, unsigned int hdrNum, Header h);
+
+/**
+ * Remove the summary of a package.
+ * @param sum		package summary
+ * @param hdrNum	header instance
+ */
+RPM_GNUC_INTERNAL
+void rpmdbsumDel(rpmdbsum sum, unsigned int hdrNum);
+
+/**
+ * Return the next summarized header instance.
+ * @param sum		package summary
+ * @param hdrNum	previous header instance (0 to start)
+ * @return		next larger header instance, 0 at end
+ */
+RPM_GNUC_INTERNAL
+unsigned int rpmdbsumNext(rpmdbsum sum, unsigned int hdrNum);
+
+/**
+ * Create a header holding just the summarized tags of a package.
+ * @param sum		package summary
+ * @param hdrNum	header instance
+ * @return		new header, NULL if not found
+ */
+RPM_GNUC_INTERNAL
+Header rpmdbsumHeader(rpmdbsum sum, unsigned int hdrNum);
+
+/**
+ * Can a tag be retrieved from summary headers with the same result as
+ * from the full header? Covers the summarized tags and the extensions
+ * computed from them only.
+ * @param sum		package summary
+ * @param tag		tag (or extension)
+ * @return		1 if covered, 0 otherwise
+ */
+RPM_GNUC_INTERNAL
+int rpmdbsumCovers(rpmdbsum sum, rpmTagVal tag);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* H_RPMDBSUM */
@@ -270,18 +270,22 @@ rpmds rpmdsNewPool(rpmstrPool pool, Header h, rpmTagVal tagN, int flags)
     if (dsType(tagN, &Type, &tagEVR, &tagF, &tagTi))
 	goto exit;
 
-    if (headerGet(h, tagN, &names, HEADERGET_MINMEM)) {
+    /* Strings go straight into the pool, no need for pointer tables */
+    if (headerGet(h, tagN, &names, HEADERGET_MINMEM | HEADERGET_PACKED)) {
 	struct rpmtd_s evr, dflags, tindices;
 	rpm_count_t count = rpmtdCount(&names);
 
-	headerGet(h, tagEVR, &evr, HEADERGET_MINMEM);
+	headerGet(h, tagEVR, &evr, HEADERGET_MINMEM | HEADERGET_PACKED);
 	if (evr.count && evr.count != count) {
+	    rpmtdFreeData(&names);
 	    rpmtdFreeData(&evr);
 	    return NULL;
 	}
 
 	headerGet(h, tagF, &dflags, HEADERGET_ALLOC);
 	if (dflags.count && dflags.count != count) {
+	    rpmtdFreeData(&names);
+	    rpmtdFreeData(&evr);
 	    rpmtdFreeData(&dflags);
 	    return NULL;
 	}
@@ -289,6 +293,9 @@ rpmds rpmdsNewPool(rpmstrPool pool, Header h, rpmTagVal tagN, int flags)
 	if (tagTi != RPMTAG_NOT_FOUND) {
 	    headerGet(h, tagTi, &tindices, HEADERGET_ALLOC);
 	    if (tindices.count && tindices.count != count) {
+		rpmtdFreeData(&names);
+		rpmtdFreeData(&evr);
+		rpmtdFreeData(&dflags);
 		rpmtdFreeData(&tindices);
 		return NULL;
 	    }
@@ -1116,6 +1123,14 @@ static const struct rpmlibProvides_s rpmlibProvides[] = {
     { "rpmlib(PayloadIsZstd)",		"5.4.18-1",
 	(RPMSENSE_RPMLIB|RPMSENSE_EQUAL),
     N_("package payload can be compressed using zstd.") },
+    { "rpmlib(PayloadZstdDict)",	"4.18.90-1",
+	(RPMSENSE_RPMLIB|RPMSENSE_EQUAL),
+    N_("package payload can be compressed using a trained zstd dictionary.") },
+#endif
+#ifdef HAVE_LZ4
+    { "rpmlib(PayloadIsLz4)",		"4.18.90-1",
+	(RPMSENSE_RPMLIB|RPMSENSE_EQUAL),
+    N_("package payload can be compressed using lz4.") },
 #endif
     { NULL,				NULL, 0,	NULL }
 };
@@ -185,8 +185,8 @@ static int rpmfnInit(rpmfn fndata, rpmTagVal bntag, Header h, rpmstrPool pool)
     }
 
     /* Grab and validate file triplet data (if there is any) */
-    if (headerGet(h, bntag, &bn, HEADERGET_MINMEM)) {
-	headerGet(h, dntag, &dn, HEADERGET_MINMEM);
+    if (headerGet(h, bntag, &bn, HEADERGET_MINMEM | HEADERGET_PACKED)) {
+	headerGet(h, dntag, &dn, HEADERGET_MINMEM | HEADERGET_PACKED);
 	headerGet(h, ditag, &dx, HEADERGET_ALLOC);
 
 	if (indexSane(&bn, &dn, &dx)) {
@@ -1322,7 +1322,7 @@ static rpmsid * tag2pool(rpmstrPool pool, Header h, rpmTag tag, rpm_count_t size
 {
     rpmsid *sids = NULL;
     struct rpmtd_s td;
-    if (headerGet(h, tag, &td, HEADERGET_MINMEM)) {
+    if (headerGet(h, tag, &td, HEADERGET_MINMEM | HEADERGET_PACKED)) {
 	if (rpmtdCount(&td) == size) { /* ensure right size */
 	    sids = rpmtdToPool(&td, pool);
 	}
@@ -1498,7 +1498,8 @@ static uint8_t *hex2binv(Header h, rpmTagVal tag, rpm_count_t num,
     uint8_t *bin = NULL;
     uint32_t *offs = NULL;
 
-    if (headerGet(h, tag, &td, HEADERGET_MINMEM) && rpmtdCount(&td) == num) {
+    if (headerGet(h, tag, &td, HEADERGET_MINMEM | HEADERGET_PACKED) &&
+	    rpmtdCount(&td) == num) {
 	const char *s;
 	int i = 0;
 	uint8_t *t = bin = xmalloc(((rpmtdSize(&td) / 2) + 1));
@@ -1532,7 +1533,8 @@ static uint8_t *hex2bin(Header h, rpmTagVal tag, rpm_count_t num, size_t len)
     struct rpmtd_s td;
     uint8_t *bin = NULL;
 
-    if (headerGet(h, tag, &td, HEADERGET_MINMEM) && rpmtdCount(&td) == num) {
+    if (headerGet(h, tag, &td, HEADERGET_MINMEM | HEADERGET_PACKED) &&
+	    rpmtdCount(&td) == num) {
 	uint8_t *t = bin = xmalloc(num * len);
 	const char *s;
 
@@ -1571,7 +1573,8 @@ static uint8_t *base2bin(Header h, rpmTagVal tag, rpm_count_t num, int *len)
     size_t *lengths = xcalloc(num, sizeof(size_t));
     const char *s;
 
-    if (!headerGet(h, tag, &td, HEADERGET_MINMEM) || rpmtdCount(&td) != num)
+    if (!headerGet(h, tag, &td, HEADERGET_MINMEM | HEADERGET_PACKED) ||
+	    rpmtdCount(&td) != num)
 	goto out;
 
     while ((s = rpmtdNextString(&td))) {
@@ -2401,6 +2404,19 @@ int rpmfiArchiveReadToFilePsm(rpmfi fi, FD_t fd, int nodigest, rpmpsm psm)
 	fdInitDigest(fd, digestalgo, 0);
     }
 
+    /* Uncompressed payloads can go straight from package to file */
+    if (left) {
+	ssize_t copied = rpmcpioCopy(fi->archive, fd, left);
+	if (copied < 0) {
+	    rc = copied;
+	    goto exit;
+	}
+	if (copied > 0) {
+	    rpmpsmNotify(psm, RPMCALLBACK_INST_PROGRESS, rpmfiArchiveTell(fi));
+	    left -= copied;
+	}
+    }
+
     while (left) {
 	size_t len;
 	len = (left > sizeof(buf) ? sizeof(buf) : left);
@@ -4,6 +4,7 @@
 #include <rpm/rpmstring.h>
 #include <rpm/rpmstrpool.h>
 #include "lib/misc.h"		/* format function prototypes */
+#include "lib/header_internal.h"
 
 #include "debug.h"
 
@@ -189,6 +190,20 @@ uint64_t * rpmtdGetUint64(rpmtd td)
     return res;
 }
 
+/* Seek a packed string array, sequential access is O(1) */
+static const char * packedString(rpmtd td, int ix)
+{
+    rpmtdPacked p = td->data;
+
+    if (ix < p->ix) {
+	p->str = p->base;
+	p->ix = 0;
+    }
+    for (; p->ix < ix; p->ix++)
+	p->str += strlen(p->str) + 1;
+    return p->str;
+}
+
 const char * rpmtdGetString(rpmtd td)
 {
     const char *str = NULL;
@@ -202,7 +217,10 @@ const char * rpmtdGetString(rpmtd td)
 	       td->type == RPM_I18NSTRING_TYPE) {
 	/* XXX TODO: check for array bounds */
 	int ix = (td->ix >= 0 ? td->ix : 0);
-	str = *((const char**) td->data + ix);
+	if (td->flags & RPMTD_PACKED)
+	    str = packedString(td, ix);
+	else
+	    str = *((const char**) td->data + ix);
     } 
     return str;
 }
@@ -428,7 +446,7 @@ rpmtd rpmtdDup(rpmtd td)
     /* deep-copy container and data, drop immutable flag */
     newtd = rpmtdNew();
     memcpy(newtd, td, sizeof(*td));
-    newtd->flags &= ~(RPMTD_IMMUTABLE);
+    newtd->flags &= ~(RPMTD_IMMUTABLE | RPMTD_PACKED);
 
     newtd->flags |= (RPMTD_ALLOCED | RPMTD_PTR_ALLOCED);
     newtd->data = data = xmalloc(td->count * sizeof(*data));
@@ -449,8 +467,17 @@ rpmsid * rpmtdToPool(rpmtd td, rpmstrPool pool)
 	case RPM_STRING_ARRAY_TYPE:
 	case RPM_I18NSTRING_TYPE:
 	    sids = xmalloc(td->count * sizeof(*sids));
-	    for (rpm_count_t i = 0; i < td->count; i++)
-		sids[i] = rpmstrPoolId(pool, strings[i], 1);
+	    if (td->flags & RPMTD_PACKED) {
+		const char *s = ((rpmtdPacked) td->data)->base;
+		for (rpm_count_t i = 0; i < td->count; i++) {
+		    size_t slen = strlen(s);
+		    sids[i] = rpmstrPoolIdn(pool, s, slen, 1);
+		    s += slen + 1;
+		}
+	    } else {
+		for (rpm_count_t i = 0; i < td->count; i++)
+		    sids[i] = rpmstrPoolId(pool, strings[i], 1);
+	    }
 	    break;
 	}
     }
@@ -191,7 +191,8 @@ static int addTE(rpmte p, Header h, fnpyKey key, rpmRelocation * relocs)
     p->enhances = rpmdsNewPool(tspool, h, RPMTAG_ENHANCENAME, 0);
 
     /* Relocation needs to know file count before rpmfiNew() */
-    headerGet(h, RPMTAG_BASENAMES, &bnames, HEADERGET_MINMEM);
+    headerGet(h, RPMTAG_BASENAMES, &bnames,
+		HEADERGET_MINMEM | HEADERGET_PACKED);
     p->fs = rpmfsNew(rpmtdCount(&bnames),
 		    (p->type == TR_ADDED || p->type == TR_RESTORED));
     rpmtdFreeData(&bnames);
@@ -557,7 +558,9 @@ static Header rpmteFDHeader(rpmte te)
 
 	ovsflags = rpmtsSetVSFlags(te->ts,
 				   rpmtsVSFlags(te->ts) | RPMVSF_NEEDPAYLOAD);
-	pkgrc = rpmReadPackageFile(te->ts, te->fd, rpmteNEVRA(te), &h);
+	/* The header gets exported into rpmdb, keep the original for it */
+	pkgrc = rpmpkgReadFile(te->ts, te->fd, rpmteNEVRA(te),
+				HEADERIMPORT_KEEP, &h);
 	rpmtsSetVSFlags(te->ts, ovsflags);
 	switch (pkgrc) {
 	default:
@@ -645,9 +648,24 @@ FD_t rpmtePayload(rpmte te)
     FD_t payload = NULL;
     if (te->fd && te->h) {
 	const char *compr = headerGetString(te->h, RPMTAG_PAYLOADCOMPRESSOR);
-	char *ioflags = rstrscat(NULL, "r.", compr ? compr : "gzip", NULL);
+	uint32_t dictid = headerGetNumber(te->h, RPMTAG_PAYLOADDICTID);
+	int ahead = rpmExpandNumeric("%{?_payload_readahead}");
+	char *ioflags = NULL;
+
+	/* Load a payload dictionary up front to fail before touching files */
+	if (dictid && compr && rstreq(compr, "zstd"))
+	    rasprintf(&ioflags, "rD%u.%s", dictid, compr ? compr : "gzip");
+	else
+	    ioflags = rstrscat(NULL, "r.", compr ? compr : "gzip", NULL);
 	payload = Fdopen(fdDup(Fileno(te->fd)), ioflags);
 	free(ioflags);
+
+	/* Decompress ahead of the file writes in a separate thread */
+	if (payload && ahead > 0) {
+	    rasprintf(&ioflags, "r%d.aheadio", ahead);
+	    payload = Fdopen(payload, ioflags);
+	    free(ioflags);
+	}
     }
     return payload;
 }
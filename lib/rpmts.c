@@ -83,6 +83,14 @@ int rpmtsCloseDB(rpmts ts)
 			rpmdbOp(ts->rdb, RPMDB_OP_DBPUT));
 	(void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_DBDEL),
 			rpmdbOp(ts->rdb, RPMDB_OP_DBDEL));
+	(void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_DBPREP),
+			rpmdbOp(ts->rdb, RPMDB_OP_DBPREP));
+	(void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_DBSTMT),
+			rpmdbOp(ts->rdb, RPMDB_OP_DBSTMT));
+	(void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_HDRCACHE),
+			rpmdbOp(ts->rdb, RPMDB_OP_HDRCACHE));
+	(void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_HDRLOAD),
+			rpmdbOp(ts->rdb, RPMDB_OP_HDRLOAD));
 	rc = rpmdbClose(ts->rdb);
 	ts->rdb = NULL;
     }
@@ -470,8 +478,11 @@ static Header makeImmutable(Header h)
 	rpmDigestBundleAdd(bundle, RPM_HASH_SHA1, RPMDIGEST_NONE);
 	rpmDigestBundleAdd(bundle, RPM_HASH_SHA256, RPMDIGEST_NONE);
 
-	rpmDigestBundleUpdate(bundle, rpm_header_magic, sizeof(rpm_header_magic));
-	rpmDigestBundleUpdate(bundle, blob, blen);
+	struct iovec iov[] = {
+	    { (void *)rpm_header_magic, sizeof(rpm_header_magic) },
+	    { blob, blen },
+	};
+	rpmDigestBundleUpdateV(bundle, iov, 2);
 
 	rpmDigestBundleFinal(bundle, RPM_HASH_SHA1, (void **)&sha1, NULL, 1);
 	rpmDigestBundleFinal(bundle, RPM_HASH_SHA256, (void **)&sha256, NULL, 1);
@@ -815,6 +826,10 @@ static void rpmtsPrintStats(rpmts ts)
     rpmtsPrintStat("dbget:       ", rpmtsOp(ts, RPMTS_OP_DBGET));
     rpmtsPrintStat("dbput:       ", rpmtsOp(ts, RPMTS_OP_DBPUT));
     rpmtsPrintStat("dbdel:       ", rpmtsOp(ts, RPMTS_OP_DBDEL));
+    rpmtsPrintStat("dbprep:      ", rpmtsOp(ts, RPMTS_OP_DBPREP));
+    rpmtsPrintStat("dbstmt:      ", rpmtsOp(ts, RPMTS_OP_DBSTMT));
+    rpmtsPrintStat("hdrcache:    ", rpmtsOp(ts, RPMTS_OP_HDRCACHE));
+    rpmtsPrintStat("hdrload:     ", rpmtsOp(ts, RPMTS_OP_HDRLOAD));
 }
 
 rpmts rpmtsFree(rpmts ts)
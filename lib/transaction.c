@@ -1039,6 +1039,9 @@ rpmdbMatchIterator rpmFindBaseNamesInDB(rpmts ts, uint64_t fileCount)
     int oc = 0;
     const char * baseName;
     rpmsid baseNameId;
+    const char **keys = NULL;
+    size_t *keylens = NULL;
+    int nkeys = 0, akeys = 0;
 
     rpmStringSet baseNames = rpmStringSetCreate(fileCount, 
 					sidHash, sidCmp, NULL);
@@ -1064,7 +1067,14 @@ rpmdbMatchIterator rpmFindBaseNamesInDB(rpmts ts, uint64_t fileCount)
 	    baseName = rpmstrPoolStr(tspool, baseNameId);
 	    if (keylen == 0)
 		keylen++;	/* XXX "/" fixup. */
-	    rpmdbExtendIterator(mi, baseName, keylen);
+	    if (nkeys == akeys) {
+		akeys = akeys ? akeys * 2 : 256;
+		keys = xrealloc(keys, akeys * sizeof(*keys));
+		keylens = xrealloc(keylens, akeys * sizeof(*keylens));
+	    }
+	    keys[nkeys] = baseName;
+	    keylens[nkeys] = keylen;
+	    nkeys++;
 	    rpmStringSetAddEntry(baseNames, baseNameId);
 	}
 	rpmfiFree(fi);
@@ -1073,6 +1083,12 @@ rpmdbMatchIterator rpmFindBaseNamesInDB(rpmts ts, uint64_t fileCount)
     rpmtsiFree(pi);
     rpmStringSetFree(baseNames);
 
+    /* Look up all the basenames in one go, the strings live in tspool */
+    if (nkeys)
+	rpmdbExtendIteratorMany(mi, keys, keylens, nkeys);
+    free(keys);
+    free(keylens);
+
     rpmdbSortIterator(mi);
     /* iterator is now sorted by (recnum, filenum) */
     return mi;
@@ -9,6 +9,10 @@
 #include "debug.h"
 
 #define DIGESTS_MAX 12
+
+/* Min. input size to update the contexts of a bundle in parallel */
+#define DIGEST_PARALLEL_MIN	(256 * 1024)
+
 struct rpmDigestBundle_s {
     int index_max;			/*!< Largest index of active digest */
     off_t nbytes;			/*!< Length of total input data */
@@ -76,15 +80,47 @@ int rpmDigestBundleAddID(rpmDigestBundle bundle, int algo, int id,
     return rc;
 }
 int rpmDigestBundleUpdate(rpmDigestBundle bundle, const void *data, size_t len)
+{
+    struct iovec iov = { (void *)data, len };
+    return (data != NULL) ? rpmDigestBundleUpdateV(bundle, &iov, 1) : 0;
+}
+
+int rpmDigestBundleUpdateV(rpmDigestBundle bundle,
+			   const struct iovec *iov, int iovcnt)
 {
     int rc = 0;
-    if (bundle && data && len > 0) {
-	for (int i = 0; i <= bundle->index_max; i++) {
-	    if (bundle->ids[i] > 0)
-		rc += rpmDigestUpdate(bundle->digests[i], data, len);
+    int nactive = 0;
+    size_t len = 0;
+
+    if (bundle == NULL || iov == NULL)
+	return 0;
+
+    for (int j = 0; j < iovcnt; j++)
+	len += iov[j].iov_len;
+    for (int i = 0; i <= bundle->index_max; i++) {
+	if (bundle->ids[i] > 0)
+	    nactive++;
+    }
+    if (len == 0)
+	return 0;
+    if (nactive == 0)
+	goto exit;
+
+    /* The contexts are independent, hash large inputs in all at once */
+    #pragma omp parallel for reduction(+:rc) num_threads(nactive) \
+	if (nactive > 1 && len >= DIGEST_PARALLEL_MIN)
+    for (int i = 0; i <= bundle->index_max; i++) {
+	if (bundle->ids[i] <= 0)
+	    continue;
+	for (int j = 0; j < iovcnt; j++) {
+	    if (iov[j].iov_len > 0)
+		rc += rpmDigestUpdate(bundle->digests[i],
+				      iov[j].iov_base, iov[j].iov_len);
 	}
-	bundle->nbytes += len;
     }
+
+exit:
+    bundle->nbytes += len;
     return rc;
 }
 
@@ -9,6 +9,13 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <sys/resource.h>
+#include <sys/mman.h>
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+#ifdef ENABLE_OPENMP
+#include <omp.h>
+#endif
 
 #include <rpm/rpmlog.h>
 #include <rpm/rpmmacro.h>
@@ -157,6 +164,13 @@ static const FDIO_t lzdio;
 #ifdef HAVE_ZSTD
 static const FDIO_t zstdio;
 #endif
+#ifdef HAVE_LZ4
+static const FDIO_t lz4dio;
+#endif
+static const FDIO_t aheadio;
+static const FDIO_t bufio;
+static FD_t pzFdopen(FD_t fd, int fdno, const char *fmode, int bzip2,
+		     int threads);
 
 /** \ingroup rpmio
  * Update digest(s) attached to fd.
@@ -421,12 +435,148 @@ static const struct FDIO_s fdio_s = {
 };
 static const FDIO_t fdio = &fdio_s ;
 
+/* Max. bytes to move in one kernel copy call */
+#define KCOPY_CHUNK	(1024 * 1024 * 1024)
+
+enum kcopy_e {
+    KCOPY_RANGE		= 0,	/*!< copy_file_range(2) */
+    KCOPY_SENDFILE	= 1,	/*!< sendfile(2) */
+    KCOPY_SPLICE	= 2,	/*!< splice(2) */
+    KCOPY_NONE		= 3,
+};
+
+/* Is errno an indication that the copy method doesn't apply here? */
+static int kcopyUnsupported(int err)
+{
+    return (err == EXDEV || err == EINVAL || err == ENOSYS ||
+	    err == EOPNOTSUPP || err == EBADF || err == ESPIPE);
+}
+
+static ssize_t kcopy(enum kcopy_e method, int sfdno, int tfdno, size_t count)
+{
+    ssize_t rc = -1;
+
+    errno = ENOSYS;
+    switch (method) {
+    case KCOPY_RANGE:
+#ifdef HAVE_COPY_FILE_RANGE
+	rc = copy_file_range(sfdno, NULL, tfdno, NULL, count, 0);
+#endif
+	break;
+    case KCOPY_SENDFILE:
+#ifdef HAVE_SENDFILE
+	rc = sendfile(tfdno, sfdno, NULL, count);
+#endif
+	break;
+    case KCOPY_SPLICE:
+#ifdef HAVE_SPLICE
+	rc = splice(sfdno, NULL, tfdno, NULL, count, SPLICE_F_MOVE);
+#endif
+	break;
+    case KCOPY_NONE:
+	break;
+    }
+    return rc;
+}
+
+/* Plain descriptors have nothing between us and the kernel */
+static int fdIsPlain(FD_t fd)
+{
+    FDSTACK_t fps = fdGetFps(fd);
+    return (fps && (fps->io == fdio || fps->io == ufdio) && fps->fdno >= 0);
+}
+
+off_t fdCopy(FD_t sfd, FD_t tfd, off_t len)
+{
+    enum kcopy_e method = KCOPY_RANGE;
+    uint8_t *map = NULL;
+    size_t maplen = 0;
+    off_t mapoff = 0;
+    off_t total = 0;
+    int sfdno, tfdno;
+
+    if (!fdIsPlain(sfd) || !fdIsPlain(tfd) || len == 0)
+	return 0;
+    sfdno = Fileno(sfd);
+    tfdno = Fileno(tfd);
+
+    /*
+     * Data never enters user space so digests can't be updated on the
+     * fly, instead hash the copied range from a mapping of the source.
+     */
+    if (sfd->digests || tfd->digests) {
+	off_t pos = lseek(sfdno, 0, SEEK_CUR);
+	off_t pagesize = sysconf(_SC_PAGESIZE);
+	struct stat sb;
+
+	if (len < 0 || pos < 0 || fstat(sfdno, &sb) || !S_ISREG(sb.st_mode) ||
+		pos + len > sb.st_size)
+	    return 0;
+
+	mapoff = pos & ~(pagesize - 1);
+	maplen = len + (pos - mapoff);
+	map = mmap(NULL, maplen, PROT_READ, MAP_PRIVATE, sfdno, mapoff);
+	if (map == MAP_FAILED)
+	    return 0;
+	(void) madvise(map, maplen, MADV_SEQUENTIAL);
+	mapoff = pos - mapoff;
+    }
+
+    fdstat_enter(sfd, FDSTAT_READ);
+    fdstat_enter(tfd, FDSTAT_WRITE);
+    while (len < 0 || total < len) {
+	size_t count = KCOPY_CHUNK;
+	ssize_t rc;
+
+	if (len >= 0 && len - total < count)
+	    count = len - total;
+
+	do {
+	    rc = kcopy(method, sfdno, tfdno, count);
+	} while (rc < 0 && errno == EINTR);
+
+	if (rc < 0) {
+	    if (!kcopyUnsupported(errno)) {
+		total = -1;
+		break;
+	    }
+	    /* Try the next method, or leave the rest to the caller */
+	    if (++method == KCOPY_NONE)
+		break;
+	    continue;
+	}
+	if (rc == 0)
+	    break;
+
+	if (map) {
+	    if (sfd->digests)
+		fdUpdateDigests(sfd, map + mapoff + total, rc);
+	    if (tfd->digests)
+		fdUpdateDigests(tfd, map + mapoff + total, rc);
+	}
+	total += rc;
+    }
+
+    fdstat_exit(sfd, FDSTAT_READ, total);
+    fdstat_exit(tfd, FDSTAT_WRITE, total);
+
+    if (map)
+	munmap(map, maplen);
+
+    return total;
+}
+
 off_t ufdCopy(FD_t sfd, FD_t tfd)
 {
     char buf[BUFSIZ];
     ssize_t rdbytes, wrbytes;
     off_t total = 0;
 
+    /* Let the kernel move the data directly when possible */
+    total = fdCopy(sfd, tfd, -1);
+    if (total < 0)
+	return -1;
+
     while (1) {
 	rdbytes = Fread(buf, sizeof(buf[0]), sizeof(buf), sfd);
 
@@ -536,6 +686,37 @@ static int parsethreadn(const char *s, char **end)
     return threads;
 }
 
+/* Thread count for decompression, from %_payload_decompress_threads */
+static int decompthreadn(void)
+{
+    char *s = rpmExpand("%{?_payload_decompress_threads}", NULL);
+    int threads = parsethreadn(s, NULL);
+    free(s);
+    return threads;
+}
+
+/*
+ * Split the thread count off a mode string: zlib and bzlib have their
+ * own, incompatible uses for 'T' and the digits following it.
+ */
+static int splitthreadn(const char *fmode, char *mode, size_t msize)
+{
+    char *t = mode;
+    char *te = mode + msize - 1;
+    int threads = 0;
+
+    for (const char *s = fmode; *s; s++) {
+	if (*s == 'T') {
+	    threads = parsethreadn(s+1, (char **)&s);
+	    s--;
+	} else if (t < te) {
+	    *t++ = *s;
+	}
+    }
+    *t = '\0';
+    return threads;
+}
+
 static const struct FDIO_s ufdio_s = {
   "ufdio", NULL,
   fdRead, fdWrite, fdSeek, fdClose,
@@ -547,9 +728,42 @@ static const FDIO_t ufdio = &ufdio_s ;
 /* Support for GZIP library.  */
 #include <zlib.h>
 
+/* Peek (without consuming) whether a readable fd has gzip content */
+static int gzdIsGzip(int fdno)
+{
+    unsigned char magic[2];
+    off_t pos = lseek(fdno, 0, SEEK_CUR);
+    ssize_t nb;
+
+    /* Can't tell on pipes and such, assume it is */
+    if (pos < 0)
+	return 1;
+    do {
+	nb = pread(fdno, magic, sizeof(magic), pos);
+    } while (nb < 0 && errno == EINTR);
+    if (nb < 0)
+	return 1;
+    return (nb == 2 && magic[0] == 0x1f && magic[1] == 0x8b);
+}
+
 static FD_t gzdFdopen(FD_t fd, int fdno, const char *fmode)
 {
-    gzFile gzfile = gzdopen(fdno, fmode);
+    char mode[32];
+    int threads = splitthreadn(fmode, mode, sizeof(mode));
+    gzFile gzfile;
+
+    if (threads > 1 && *mode == 'w')
+	return pzFdopen(fd, fdno, mode, 0, threads);
+
+    /*
+     * Uncompressed payloads historically go through zlib's transparent
+     * mode. Reading them as-is is equivalent, and keeps the descriptor
+     * plain so it can be copied within the kernel.
+     */
+    if (*mode == 'r' && !gzdIsGzip(fdno))
+	return fd;
+
+    gzfile = gzdopen(fdno, mode);
 
     if (gzfile == NULL)
 	return NULL;
@@ -661,7 +875,14 @@ static const FDIO_t gzdio = &gzdio_s ;
 
 static FD_t bzdFdopen(FD_t fd, int fdno, const char * fmode)
 {
-    BZFILE *bzfile = BZ2_bzdopen(fdno, fmode);
+    char mode[32];
+    int threads = splitthreadn(fmode, mode, sizeof(mode));
+    BZFILE *bzfile;
+
+    if (threads > 1 && *mode == 'w')
+	return pzFdopen(fd, fdno, mode, 1, threads);
+
+    bzfile = BZ2_bzdopen(fdno, mode);
 
     if (bzfile == NULL)
 	return NULL;
@@ -726,6 +947,454 @@ static const FDIO_t bzdio = &bzdio_s ;
 
 #endif	/* HAVE_BZLIB_H */
 
+/* =============================================================== */
+/*
+ * Parallel block compression for gzip and bzip2. Input is split into
+ * chunks which are compressed in parallel and stitched together into
+ * a single standard stream, decodable by any gzip/bzip2 reader:
+ * - gzip: raw deflate chunks primed with the preceding 32k of input
+ *   and ended with a sync flush, wrapped in a gzip header and trailer
+ * - bzip2: each chunk fits in one bzip2 block, the blocks are copied
+ *   bitwise into one stream with a recalculated combined CRC
+ */
+
+#define PZ_DICT		(32 * 1024)	/* deflate window */
+#define PZ_GZCHUNK	(128 * 1024)
+
+typedef struct pzchunk_s {
+    uint8_t * out;		/*!< compressed chunk */
+    size_t outlen;
+    size_t outsize;
+    uint32_t crc;		/*!< crc32 of input (gzip) */
+    int rc;
+} * pzchunk;
+
+typedef struct pzfile_s {
+    FILE * fp;
+    int bzip2;
+    int level;			/*!< compression level / bzip2 block size */
+    int strategy;		/*!< deflate strategy */
+    int nchunks;		/*!< no. of chunks compressed in parallel */
+    size_t chunksize;
+    pzchunk chunks;
+    uint8_t * buf;		/*!< [dictionary] + input */
+    uint8_t * in;		/*!< input start within buf */
+    size_t inlen;
+    size_t dictlen;
+    int started;		/*!< stream header written? */
+    uint32_t crc;		/*!< gzip crc32 / bzip2 combined crc */
+    uint32_t total;		/*!< gzip input size modulo 2^32 */
+    uint8_t * obuf;		/*!< output (bzip2 bit stream) */
+    size_t olen;
+    size_t osize;
+    uint32_t bits;		/*!< pending output bits (bzip2) */
+    int nbits;
+} * pzfile;
+
+static void pzGrow(pzfile pz, size_t n)
+{
+    if (pz->olen + n > pz->osize) {
+	pz->osize = pz->olen + n + BUFSIZ;
+	pz->obuf = xrealloc(pz->obuf, pz->osize);
+    }
+}
+
+static void pzPutBytes(pzfile pz, const void *b, size_t n)
+{
+    pzGrow(pz, n);
+    memcpy(pz->obuf + pz->olen, b, n);
+    pz->olen += n;
+}
+
+static void pzPut32le(pzfile pz, uint32_t v)
+{
+    uint8_t b[4] = { v, v >> 8, v >> 16, v >> 24 };
+    pzPutBytes(pz, b, sizeof(b));
+}
+
+static int pzWriteOut(pzfile pz)
+{
+    int rc = 0;
+    if (pz->olen && fwrite(pz->obuf, 1, pz->olen, pz->fp) != pz->olen)
+	rc = -1;
+    pz->olen = 0;
+    return rc;
+}
+
+static void pzGzChunk(pzfile pz, int i)
+{
+    pzchunk c = &pz->chunks[i];
+    const uint8_t *in = pz->in + i * pz->chunksize;
+    size_t len = pz->inlen - i * pz->chunksize;
+    size_t dictlen = (i == 0) ? pz->dictlen : PZ_DICT;
+    z_stream strm;
+
+    if (len > pz->chunksize)
+	len = pz->chunksize;
+
+    memset(&strm, 0, sizeof(strm));
+    c->crc = crc32(0, in, len);
+    c->rc = deflateInit2(&strm, pz->level, Z_DEFLATED, -MAX_WBITS, 8,
+			 pz->strategy);
+    if (c->rc != Z_OK)
+	return;
+    if (dictlen)
+	c->rc = deflateSetDictionary(&strm, in - dictlen, dictlen);
+
+    /* sync flush adds an empty stored block on top of the bound */
+    if (c->out == NULL) {
+	c->outsize = deflateBound(&strm, pz->chunksize) + 16;
+	c->out = xmalloc(c->outsize);
+    }
+    strm.next_in = (Bytef *) in;
+    strm.avail_in = len;
+    strm.next_out = c->out;
+    strm.avail_out = c->outsize;
+    if (c->rc == Z_OK)
+	c->rc = deflate(&strm, Z_SYNC_FLUSH);
+    if (c->rc == Z_OK && (strm.avail_in || !strm.avail_out))
+	c->rc = Z_BUF_ERROR;
+    c->outlen = c->outsize - strm.avail_out;
+    deflateEnd(&strm);
+}
+
+static int pzGzOut(pzfile pz, int nchunks)
+{
+    if (!pz->started) {
+	int xfl = (pz->level == 9) ? 2 : (pz->level == 1) ? 4 : 0;
+	uint8_t hdr[10] = { 0x1f, 0x8b, Z_DEFLATED, 0, 0, 0, 0, 0, xfl, 3 };
+	pzPutBytes(pz, hdr, sizeof(hdr));
+	pz->started = 1;
+    }
+
+    for (int i = 0; i < nchunks; i++) {
+	pzchunk c = &pz->chunks[i];
+	size_t len = pz->inlen - i * pz->chunksize;
+
+	if (c->rc != Z_OK)
+	    return -1;
+	if (len > pz->chunksize)
+	    len = pz->chunksize;
+	pz->crc = crc32_combine(pz->crc, c->crc, len);
+	pz->total += len;
+	pzPutBytes(pz, c->out, c->outlen);
+    }
+    return 0;
+}
+
+static int pzGzFinish(pzfile pz)
+{
+    /* empty final block, followed by the trailer */
+    static const uint8_t fin[] = { 0x03, 0x00 };
+    pzPutBytes(pz, fin, sizeof(fin));
+    pzPut32le(pz, pz->crc);
+    pzPut32le(pz, pz->total);
+    return 0;
+}
+
+#ifdef HAVE_BZLIB_H
+/* bzip2 block and end of stream magics, as 2x24 bits */
+#define PZ_BZBLOCK1	0x314159
+#define PZ_BZBLOCK2	0x265359
+#define PZ_BZEOS1	0x177245
+#define PZ_BZEOS2	0x385090
+
+static uint32_t pzGetBits(const uint8_t *b, size_t pos, int n)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < n; i++, pos++)
+	v = (v << 1) | ((b[pos / 8] >> (7 - pos % 8)) & 1);
+    return v;
+}
+
+static void pzPutBits(pzfile pz, uint32_t v, int n)
+{
+    pzGrow(pz, 4);
+    pz->bits = (pz->bits << n) | (v & ((1U << n) - 1));
+    pz->nbits += n;
+    while (pz->nbits >= 8) {
+	pz->nbits -= 8;
+	pz->obuf[pz->olen++] = pz->bits >> pz->nbits;
+    }
+    pz->bits &= (1U << pz->nbits) - 1;
+}
+
+/* Append bits [start, end) of b, start must be byte aligned */
+static void pzPutStream(pzfile pz, const uint8_t *b, size_t start, size_t end)
+{
+    size_t nbytes = (end - start) / 8;
+    int rest = (end - start) % 8;
+    const uint8_t *s = b + start / 8;
+
+    pzGrow(pz, nbytes + 4);
+    if (pz->nbits == 0) {
+	memcpy(pz->obuf + pz->olen, s, nbytes);
+	pz->olen += nbytes;
+    } else {
+	for (size_t i = 0; i < nbytes; i++) {
+	    pz->bits = (pz->bits << 8) | s[i];
+	    pz->obuf[pz->olen++] = pz->bits >> pz->nbits;
+	    pz->bits &= (1U << pz->nbits) - 1;
+	}
+    }
+    if (rest)
+	pzPutBits(pz, s[nbytes] >> (8 - rest), rest);
+}
+
+static void pzBzChunk(pzfile pz, int i)
+{
+    pzchunk c = &pz->chunks[i];
+    const uint8_t *in = pz->in + i * pz->chunksize;
+    size_t len = pz->inlen - i * pz->chunksize;
+    unsigned int outlen;
+
+    if (len > pz->chunksize)
+	len = pz->chunksize;
+    if (c->out == NULL) {
+	c->outsize = pz->chunksize + pz->chunksize / 100 + 600;
+	c->out = xmalloc(c->outsize);
+    }
+    outlen = c->outsize;
+    c->rc = BZ2_bzBuffToBuffCompress((char *) c->out, &outlen,
+				     (char *) in, len, pz->level, 0, 0);
+    c->outlen = outlen;
+}
+
+static int pzBzOut(pzfile pz, int nchunks)
+{
+    if (!pz->started) {
+	uint8_t hdr[4] = { 'B', 'Z', 'h', '0' + pz->level };
+	pzPutBytes(pz, hdr, sizeof(hdr));
+	pz->started = 1;
+    }
+
+    for (int i = 0; i < nchunks; i++) {
+	pzchunk c = &pz->chunks[i];
+	size_t nbits = c->outlen * 8;
+	size_t eos = 0;
+	uint32_t crc;
+
+	if (c->rc != BZ_OK || nbits < 32 + 80 + 80)
+	    return -1;
+
+	/* End of stream marker is followed by crc and up to 7 bits padding */
+	for (int pad = 0; pad < 8 && eos == 0; pad++) {
+	    size_t pos = nbits - 80 - pad;
+	    if (pzGetBits(c->out, pos, 24) == PZ_BZEOS1 &&
+		pzGetBits(c->out, pos + 24, 24) == PZ_BZEOS2)
+		eos = pos;
+	}
+	if (eos == 0 ||
+	    pzGetBits(c->out, 32, 24) != PZ_BZBLOCK1 ||
+	    pzGetBits(c->out, 56, 24) != PZ_BZBLOCK2)
+	    return -1;
+
+	/* chunks are sized to fit a single block: stream crc == block crc */
+	crc = pzGetBits(c->out, 80, 32);
+	if (crc != pzGetBits(c->out, eos + 48, 32))
+	    return -1;
+
+	pz->crc = ((pz->crc << 1) | (pz->crc >> 31)) ^ crc;
+	pzPutStream(pz, c->out, 32, eos);
+    }
+    return 0;
+}
+
+static int pzBzFinish(pzfile pz)
+{
+    pzPutBits(pz, PZ_BZEOS1, 24);
+    pzPutBits(pz, PZ_BZEOS2, 24);
+    pzPutBits(pz, pz->crc >> 16, 16);
+    pzPutBits(pz, pz->crc, 16);
+    if (pz->nbits)
+	pzPutBits(pz, 0, 8 - pz->nbits);
+    return 0;
+}
+#endif	/* HAVE_BZLIB_H */
+
+/* Compress all buffered input in parallel and write it out */
+static int pzCompress(pzfile pz)
+{
+    int nchunks = (pz->inlen + pz->chunksize - 1) / pz->chunksize;
+    int rc;
+
+    #pragma omp parallel for num_threads(pz->nchunks) if (nchunks > 1)
+    for (int i = 0; i < nchunks; i++) {
+#ifdef HAVE_BZLIB_H
+	if (pz->bzip2)
+	    pzBzChunk(pz, i);
+	else
+#endif
+	    pzGzChunk(pz, i);
+    }
+
+#ifdef HAVE_BZLIB_H
+    if (pz->bzip2)
+	rc = pzBzOut(pz, nchunks);
+    else
+#endif
+	rc = pzGzOut(pz, nchunks);
+
+    if (rc == 0)
+	rc = pzWriteOut(pz);
+
+    /* Keep the tail of the input as dictionary for the next chunk */
+    if (!pz->bzip2) {
+	size_t keep = pz->dictlen + pz->inlen;
+	if (keep > PZ_DICT)
+	    keep = PZ_DICT;
+	memmove(pz->in - keep, pz->in + pz->inlen - keep, keep);
+	pz->dictlen = keep;
+    }
+    pz->inlen = 0;
+    return rc;
+}
+
+static pzfile pzOpen(int fdno, const char *fmode, int bzip2, int threads)
+{
+    FILE *fp = fdopen(fdno, "w");
+    pzfile pz = NULL;
+
+    if (fp == NULL)
+	return NULL;
+
+    pz = xcalloc(1, sizeof(*pz));
+    pz->fp = fp;
+    pz->bzip2 = bzip2;
+    pz->nchunks = threads;
+    pz->level = bzip2 ? 9 : Z_DEFAULT_COMPRESSION;
+    pz->strategy = Z_DEFAULT_STRATEGY;
+    for (const char *s = fmode; *s; s++) {
+	if (*s >= '0' && *s <= '9')
+	    pz->level = *s - '0';
+	else if (*s == 'f')
+	    pz->strategy = Z_FILTERED;
+	else if (*s == 'h')
+	    pz->strategy = Z_HUFFMAN_ONLY;
+    }
+
+    if (bzip2) {
+	/* Worst case RLE expansion is 5/4, ensure one block per chunk */
+	if (pz->level < 1)
+	    pz->level = 1;
+	pz->chunksize = (100000 * pz->level - 19) / 5 * 4;
+	pz->buf = xmalloc(pz->nchunks * pz->chunksize);
+	pz->in = pz->buf;
+    } else {
+	pz->chunksize = PZ_GZCHUNK;
+	pz->buf = xmalloc(PZ_DICT + pz->nchunks * pz->chunksize);
+	pz->in = pz->buf + PZ_DICT;
+    }
+    pz->chunks = xcalloc(pz->nchunks, sizeof(*pz->chunks));
+    pz->crc = bzip2 ? 0 : crc32(0, NULL, 0);
+
+    return pz;
+}
+
+static ssize_t pzWrite(FDSTACK_t fps, const void * buf, size_t count)
+{
+    pzfile pz = fps->fp;
+    const uint8_t *b = buf;
+    size_t left = count;
+
+    while (left > 0) {
+	size_t n = pz->nchunks * pz->chunksize - pz->inlen;
+	if (n > left)
+	    n = left;
+	memcpy(pz->in + pz->inlen, b, n);
+	pz->inlen += n;
+	b += n;
+	left -= n;
+
+	if (pz->inlen == pz->nchunks * pz->chunksize && pzCompress(pz)) {
+	    fps->errcookie = "parallel compression failed";
+	    return -1;
+	}
+    }
+    return count;
+}
+
+static int pzFlush(FDSTACK_t fps)
+{
+    pzfile pz = fps->fp;
+    int rc = 0;
+
+    if (pz->inlen && pzCompress(pz)) {
+	fps->errcookie = "parallel compression failed";
+	rc = -1;
+    }
+    if (rc == 0)
+	rc = fflush(pz->fp);
+    return rc;
+}
+
+static int pzClose(FDSTACK_t fps)
+{
+    pzfile pz = fps->fp;
+    int rc = 0;
+
+    if (pz == NULL) return -2;
+
+    if (pz->inlen || !pz->started)
+	rc = pzCompress(pz);
+    if (rc == 0) {
+#ifdef HAVE_BZLIB_H
+	if (pz->bzip2)
+	    rc = pzBzFinish(pz);
+	else
+#endif
+	    rc = pzGzFinish(pz);
+    }
+    if (rc == 0)
+	rc = pzWriteOut(pz);
+    if (rc)
+	fps->errcookie = "parallel compression failed";
+
+    if (fclose(pz->fp) && rc == 0)
+	rc = -1;
+    for (int i = 0; i < pz->nchunks; i++)
+	free(pz->chunks[i].out);
+    free(pz->chunks);
+    free(pz->buf);
+    free(pz->obuf);
+    free(pz);
+    return rc;
+}
+
+static const struct FDIO_s pgzdio_s = {
+  "gzdio", "gzip",
+  NULL, pzWrite, NULL, pzClose,
+  NULL, NULL, pzFlush, NULL, zfdError, zfdStrerr
+};
+static const FDIO_t pgzdio = &pgzdio_s ;
+
+#ifdef HAVE_BZLIB_H
+static const struct FDIO_s pbzdio_s = {
+  "bzdio", "bzip2",
+  NULL, pzWrite, NULL, pzClose,
+  NULL, NULL, pzFlush, NULL, zfdError, zfdStrerr
+};
+static const FDIO_t pbzdio = &pbzdio_s ;
+#endif
+
+static FD_t pzFdopen(FD_t fd, int fdno, const char *fmode, int bzip2,
+		     int threads)
+{
+    pzfile pz = pzOpen(fdno, fmode, bzip2, threads);
+
+    if (pz == NULL)
+	return NULL;
+
+    fdSetFdno(fd, -1);		/* XXX skip the fdio close */
+#ifdef HAVE_BZLIB_H
+    if (bzip2)
+	fdPush(fd, pbzdio, pz, fdno);
+    else
+#endif
+	fdPush(fd, pgzdio, pz, fdno);
+    return fd;
+}
+
 /* =============================================================== */
 /* Support for LZMA library.  */
 
@@ -760,6 +1429,7 @@ static LZFILE *lzopen_internal(const char *mode, int fd, int xz)
     lzma_stream init_strm = LZMA_STREAM_INIT;
     uint64_t mem_limit = rpmExpandNumeric("%{_xz_memlimit}");
     int threads = 0;
+    int threadset = 0;
 
     for (; *mode; mode++) {
 	if (*mode == 'w')
@@ -771,9 +1441,12 @@ static LZFILE *lzopen_internal(const char *mode, int fd, int xz)
 	else if (*mode == 'T') {
 	    char *end = NULL;
 	    threads = parsethreadn(mode+1, &end);
+	    threadset = 1;
 	    mode = end-1;
 	}
     }
+    if (!encoding && !threadset)
+	threads = decompthreadn();
     fp = fdopen(fd, encoding ? "w" : "r");
     if (!fp)
 	return NULL;
@@ -784,25 +1457,45 @@ static LZFILE *lzopen_internal(const char *mode, int fd, int xz)
     lzfile->strm = init_strm;
     if (encoding) {
 	if (xz) {
-	    if (!threads) {
-		ret = lzma_easy_encoder(&lzfile->strm, level, LZMA_CHECK_SHA256);
-	    } else {
-		lzma_mt mt_options = {
-		    .flags = 0,
-		    .threads = threads,
-		    .block_size = 0,
-		    .timeout = 0,
-		    .preset = level,
-		    .filters = NULL,
-		    .check = LZMA_CHECK_SHA256 };
-
-		ret = lzma_stream_encoder_mt(&lzfile->strm, &mt_options);
-	    }
+	    /*
+	     * Always use the threaded encoder, even with a single thread:
+	     * it splits the stream into blocks with their sizes recorded
+	     * in the block headers, which allows multithreaded decoding.
+	     */
+	    lzma_mt mt_options = {
+		.flags = 0,
+		.threads = threads > 0 ? threads : 1,
+		.block_size = 0,
+		.timeout = 0,
+		.preset = level,
+		.filters = NULL,
+		.check = LZMA_CHECK_SHA256 };
+
+	    ret = lzma_stream_encoder_mt(&lzfile->strm, &mt_options);
 	} else {
 	    lzma_options_lzma options;
 	    lzma_lzma_preset(&options, level);
 	    ret = lzma_alone_encoder(&lzfile->strm, &options);
 	}
+#if LZMA_VERSION >= 50040002	/* lzma_stream_decoder_mt() is stable since 5.4.0 */
+    } else if (xz && threads > 1) {
+	/*
+	 * Threading memory defaults to a quarter of RAM like xz(1), liblzma
+	 * caps it at the stop limit which is the same as single-threaded.
+	 */
+	uint64_t mt_limit = rpmExpandNumeric("%{?_xz_threads_memlimit}");
+	if (!mt_limit)
+	    mt_limit = lzma_physmem() / 4;
+	lzma_mt mt_options = {
+	    .flags = 0,
+	    .threads = threads,
+	    .timeout = 0,
+	    .memlimit_threading = mt_limit,
+	    .memlimit_stop = mem_limit ? mem_limit : 100<<20 };
+
+	/* Single block streams are decoded in single-threaded mode */
+	ret = lzma_stream_decoder_mt(&lzfile->strm, &mt_options);
+#endif
     } else {   /* lzma_easy_decoder_memusage(level) is not ready yet, use hardcoded limit for now */
 	ret = lzma_auto_decoder(&lzfile->strm, mem_limit ? mem_limit : 100<<20, 0);
     }
@@ -998,6 +1691,30 @@ static const FDIO_t lzdio = &lzdio_s;
 #ifdef HAVE_ZSTD
 
 #include <zstd.h>
+#include <zstd_errors.h>
+
+/*
+ * Framed zstd payloads consist of independently decodable zstd frames,
+ * each preceded by a skippable frame indexing the compressed and
+ * decompressed size of the data frame that follows. Stock zstd decoders
+ * simply skip the index frames, we use them to (de)compress several
+ * frames in parallel.
+ */
+#define ZSTD_IDX_MAGIC		0x184D2A5E	/* skippable frame magic */
+#define ZSTD_IDX_SIZE		16		/* magic, size, csize, dsize */
+#define ZSTD_FRAME_DEFAULT	8		/* default frame size in MiB */
+#define ZSTD_FRAME_MAX		256		/* maximum frame size in MiB */
+
+typedef struct zstdframe_s {
+    void * ctx;			/*!< ZSTD_{C,D}Ctx */
+    uint8_t * cb;		/*!< compressed data */
+    size_t csize;
+    size_t cbsize;
+    uint8_t * db;		/*!< decompressed data */
+    size_t dsize;
+    size_t dbsize;
+    size_t rc;			/*!< (de)compression return code */
+} * zstdframe;
 
 typedef struct rpmzstd_s {
     int flags;			/*!< open flags. */
@@ -1009,26 +1726,223 @@ typedef struct rpmzstd_s {
     void * b;
     ZSTD_inBuffer zib;          /*!< ZSTD_inBuffer */
     ZSTD_outBuffer zob;         /*!< ZSTD_outBuffer */
+
+    int framed;			/*!< framed stream? (-1 unknown) */
+    size_t framesize;		/*!< frame size when compressing */
+    int nframes;		/*!< no. of frames processed in parallel */
+    zstdframe frames;
+    int nfilled;		/*!< no. of frames with data */
+    int fcur;			/*!< current frame */
+    size_t fpos;		/*!< position within current frame */
+    uint8_t idx[ZSTD_IDX_SIZE];	/*!< frame index read ahead of its batch */
+    int haveidx;		/*!< idx holds the next frame index? */
+    size_t memused;		/*!< frame buffer memory in use */
+    size_t memlimit;		/*!< frame buffer memory limit */
+    int windowlog;		/*!< window log limit when decompressing */
+
+    unsigned dictid;		/*!< trained dictionary id (0 for none) */
+    ZSTD_CDict * cdict;
+    ZSTD_DDict * ddict;
 } * rpmzstd;
 
-static rpmzstd rpmzstdNew(int fdno, const char *fmode)
+static uint32_t zstdGet32(const uint8_t *b)
 {
-    int flags = 0;
-    int level = 3;
-    const char * s = fmode;
-    char stdio[32];
-    char *t = stdio;
-    char *te = t + sizeof(stdio) - 2;
-    int c;
-    int threads = 0;
-    int windowlog = 27;
-    int longdist = 0;
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
 
-    switch ((c = *s++)) {
-    case 'a':
-	*t++ = (char)c;
-	flags &= ~O_ACCMODE;
-	flags |= O_WRONLY | O_CREAT | O_APPEND;
+static void zstdPut32(uint8_t *b, uint32_t v)
+{
+    b[0] = v; b[1] = v >> 8; b[2] = v >> 16; b[3] = v >> 24;
+}
+
+static int zstdIsIndex(const uint8_t *b)
+{
+    return (zstdGet32(b) == ZSTD_IDX_MAGIC &&
+	    zstdGet32(b+4) == ZSTD_IDX_SIZE - 8);
+}
+
+/*
+ * Load trained dictionary <dictid> from %{_zstd_dictdir}, returning
+ * a digested ZSTD_CDict when compressing and ZSTD_DDict otherwise.
+ */
+static void * zstdDictNew(unsigned dictid, int compress, int level)
+{
+    char *dir = rpmExpand("%{?_zstd_dictdir}", NULL);
+    char *fn = NULL;
+    uint8_t *b = NULL;
+    ssize_t blen = 0;
+    void *dict = NULL;
+
+    if (*dir == '\0') {
+	rpmlog(RPMLOG_ERR, _("zstd dictionary %u needed but %%_zstd_dictdir "
+			     "is not set\n"), dictid);
+	goto exit;
+    }
+
+    rasprintf(&fn, "%s/%u.dict", dir, dictid);
+    if (rpmioSlurp(fn, &b, &blen) || blen <= 0) {
+	rpmlog(RPMLOG_ERR, _("failed to load zstd dictionary %u from %s\n"),
+		dictid, fn);
+	goto exit;
+    }
+    if (ZSTD_getDictID_fromDict(b, blen) != dictid) {
+	rpmlog(RPMLOG_ERR, _("%s is not zstd dictionary %u\n"), fn, dictid);
+	goto exit;
+    }
+
+    if (compress)
+	dict = ZSTD_createCDict(b, blen, level);
+    else
+	dict = ZSTD_createDDict(b, blen);
+
+exit:
+    free(b);
+    free(fn);
+    free(dir);
+    return dict;
+}
+
+/* Parse a window log, clamped to what the library supports */
+static int zstdWindowLog(const char *s, char **end)
+{
+    int windowlog = strtol(s, end, 10);
+    ZSTD_bounds bounds = ZSTD_cParam_getBounds(ZSTD_c_windowLog);
+
+    if (windowlog < bounds.lowerBound){
+	windowlog = bounds.lowerBound;
+	rpmlog(RPMLOG_WARNING, "Invalid window log for zstd. Using %i instead.\n", bounds.lowerBound);
+    }
+    if (windowlog > bounds.upperBound) {
+	windowlog = bounds.upperBound;
+	rpmlog(RPMLOG_WARNING, "Invalid window log for zstd. Using %i instead.\n", bounds.upperBound);
+    }
+    return windowlog;
+}
+
+/* Frame buffer memory limit when decompressing, %_zstd_memlimit */
+static size_t zstdMemLimit(void)
+{
+    char *s = rpmExpand("%{?_zstd_memlimit}", NULL);
+    unsigned long long limit = strtoull(s, NULL, 10);
+    long pagesize = sysconf(_SC_PAGESIZE);
+    long pages = sysconf(_SC_PHYS_PAGES);
+
+    /*
+     * Default to a quarter of RAM like xz threading does, but always
+     * enough for a single frame of the largest size we build.
+     */
+    if (limit == 0 && pagesize > 0 && pages > 0) {
+	size_t fmax = (size_t)ZSTD_FRAME_MAX << 20;
+	limit = (unsigned long long)pages * pagesize / 4;
+	if (limit < fmax + ZSTD_compressBound(fmax))
+	    limit = fmax + ZSTD_compressBound(fmax);
+    }
+    if (limit == 0 || limit > SIZE_MAX)
+	limit = SIZE_MAX;
+    free(s);
+    return limit;
+}
+
+/* Largest window log to accept when decompressing, %_zstd_max_windowlog */
+static int zstdMaxWindowLog(void)
+{
+    int windowlog = rpmExpandNumeric("%{?_zstd_max_windowlog}");
+    ZSTD_bounds bounds = ZSTD_dParam_getBounds(ZSTD_d_windowLogMax);
+
+    /* Default to the zstd limit of 128 MiB, builders may raise it */
+    if (windowlog <= 0)
+	windowlog = 27;
+    if (windowlog > bounds.upperBound)
+	windowlog = bounds.upperBound;
+    if (windowlog < bounds.lowerBound)
+	windowlog = bounds.lowerBound;
+    return windowlog;
+}
+
+static ZSTD_DCtx * zstdDCtxNew(int windowlogmax)
+{
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+
+    if (dctx == NULL
+     || ZSTD_isError(ZSTD_DCtx_setParameter(dctx, ZSTD_d_windowLogMax, windowlogmax))) {
+	ZSTD_freeDCtx(dctx);
+	return NULL;
+    }
+    return dctx;
+}
+
+static ZSTD_CCtx * zstdCCtxNew(int level, int longdist, int windowlog,
+				int threads, const ZSTD_CDict *cdict)
+{
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+
+    if (cctx == NULL
+     || ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level))) {
+	goto err;
+    }
+
+    if (cdict && ZSTD_isError(ZSTD_CCtx_refCDict(cctx, cdict)))
+	goto err;
+
+    if (longdist) {
+	if (ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_enableLongDistanceMatching, longdist)))
+	    goto err;
+    }
+
+    if (windowlog) {
+	if (ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_windowLog, windowlog)))
+	    goto err;
+    }
+
+    if (threads > 0) {
+	if (ZSTD_isError (ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, threads)))
+	    rpmlog(RPMLOG_DEBUG, "zstd library does not support multi-threading\n");
+    }
+    return cctx;
+
+err:
+    ZSTD_freeCCtx(cctx);
+    return NULL;
+}
+
+static void zstdFramesFree(rpmzstd zstd)
+{
+    int compress = ((zstd->flags & O_ACCMODE) != O_RDONLY);
+
+    for (int i = 0; zstd->frames && i < zstd->nframes; i++) {
+	zstdframe f = &zstd->frames[i];
+	if (compress)
+	    ZSTD_freeCCtx(f->ctx);
+	else
+	    ZSTD_freeDCtx(f->ctx);
+	free(f->cb);
+	free(f->db);
+    }
+    zstd->frames = _free(zstd->frames);
+    zstd->memused = 0;
+}
+
+static rpmzstd rpmzstdNew(int fdno, const char *fmode)
+{
+    int flags = 0;
+    int level = 3;
+    const char * s = fmode;
+    char stdio[32];
+    char *t = stdio;
+    char *te = t + sizeof(stdio) - 2;
+    int c;
+    int threads = 0;
+    int threadset = 0;
+    int windowlog = 0;
+    int longdist = 0;
+    int framesize = 0;
+    unsigned dictid = 0;
+
+    switch ((c = *s++)) {
+    case 'a':
+	*t++ = (char)c;
+	flags &= ~O_ACCMODE;
+	flags |= O_WRONLY | O_CREAT | O_APPEND;
 	break;
     case 'w':
 	*t++ = (char)c;
@@ -1053,22 +1967,29 @@ static rpmzstd rpmzstdNew(int fdno, const char *fmode)
 	    continue;
 	case 'T':
 	    threads = parsethreadn(s, (char **)&s);
+	    threadset = 1;
+	    continue;
+	case 'F':
+	    framesize = strtol(s, (char **)&s, 10);
+	    if (framesize <= 0)
+		framesize = ZSTD_FRAME_DEFAULT;
+	    if (framesize > ZSTD_FRAME_MAX) {
+		framesize = ZSTD_FRAME_MAX;
+		rpmlog(RPMLOG_WARNING, "Invalid frame size for zstd. Using %i instead.\n", ZSTD_FRAME_MAX);
+	    }
+	    continue;
+	case 'D':
+	    dictid = strtoul(s, (char **)&s, 10);
 	    continue;
-    case 'L':
-	    c = *s++;
+	case 'L':
 	    longdist = 1;
-	    if (c >= (int)'0' && c <= (int)'9') {
-		windowlog = strtol(s-1, (char **)&s, 10);
-		ZSTD_bounds bounds = ZSTD_cParam_getBounds(ZSTD_c_windowLog);
-		if (windowlog < bounds.lowerBound){
-		    windowlog = bounds.lowerBound;
-		    rpmlog(RPMLOG_WARNING, "Invalid long distance matching window log for zstd. Using %i instead.\n", bounds.lowerBound);
-		}
-		if (windowlog > bounds.upperBound) {
-		    windowlog = bounds.upperBound;
-		    rpmlog(RPMLOG_WARNING, "Invalid long distance matching window log for zstd. Using %i instead.\n", bounds.upperBound);
-		}
-   	    }
+	    if (*s >= '0' && *s <= '9')
+		windowlog = zstdWindowLog(s, (char **)&s);
+	    else if (windowlog == 0)
+		windowlog = 27;
+	    continue;
+	case 'W':
+	    windowlog = zstdWindowLog(s, (char **)&s);
 	    continue;
 	default:
 	    if (c >= (int)'0' && c <= (int)'9') {
@@ -1095,30 +2016,40 @@ static rpmzstd rpmzstdNew(int fdno, const char *fmode)
 
     void * _stream = NULL;
     size_t nb = 0;
+    int nframes = 0;
+    zstdframe frames = NULL;
+    void * dict = NULL;
+
+    /* Readers find the dictionary from the frames too, this just fails early */
+    if (dictid) {
+	int compress = ((flags & O_ACCMODE) != O_RDONLY);
+	if ((dict = zstdDictNew(dictid, compress, level)) == NULL)
+	    goto err;
+    }
 
     if ((flags & O_ACCMODE) == O_RDONLY) {	/* decompressing */
-	if ((_stream = (void *) ZSTD_createDStream()) == NULL
-	 || ZSTD_isError(ZSTD_initDStream(_stream))) {
+	windowlog = zstdMaxWindowLog();
+	if ((_stream = (void *) zstdDCtxNew(windowlog)) == NULL
+	 || (dict && ZSTD_isError(ZSTD_DCtx_refDDict(_stream, dict)))) {
 	    goto err;
 	}
 	nb = ZSTD_DStreamInSize();
+	/* Framed streams are only detected on first read */
+	nframes = threadset ? threads : decompthreadn();
+    } else if (framesize) {			/* compressing frames */
+	/* Parallelism comes from frames, each compressed on a single thread */
+	nframes = threads;
+	if (nframes < 1)
+	    nframes = 1;
+	frames = xcalloc(nframes, sizeof(*frames));
+	for (int i = 0; i < nframes; i++) {
+	    frames[i].ctx = zstdCCtxNew(level, longdist, windowlog, 0, dict);
+	    if (frames[i].ctx == NULL)
+		goto err;
+	}
     } else {					/* compressing */
-	if ((_stream = (void *) ZSTD_createCCtx()) == NULL
-	 || ZSTD_isError(ZSTD_CCtx_setParameter(_stream, ZSTD_c_compressionLevel, level))) {
+	if ((_stream = zstdCCtxNew(level, longdist, windowlog, threads, dict)) == NULL)
 	    goto err;
-	}
-
-	if (longdist) {
-	    if (ZSTD_isError(ZSTD_CCtx_setParameter(_stream, ZSTD_c_enableLongDistanceMatching, longdist))
-	     || ZSTD_isError(ZSTD_CCtx_setParameter(_stream, ZSTD_c_windowLog, windowlog))) {
-	        goto err;
-	    }
-	}
-
-	if (threads > 0) {
-	    if (ZSTD_isError (ZSTD_CCtx_setParameter(_stream, ZSTD_c_nbWorkers, threads)))
-		rpmlog(RPMLOG_DEBUG, "zstd library does not support multi-threading\n");
-	}
 
 	nb = ZSTD_CStreamOutSize();
     }
@@ -1130,16 +2061,34 @@ static rpmzstd rpmzstdNew(int fdno, const char *fmode)
     zstd->fp = fp;
     zstd->_stream = _stream;
     zstd->nb = nb;
-    zstd->b = xmalloc(nb);
+    zstd->b = nb ? xmalloc(nb) : NULL;
+    zstd->framed = framesize ? 1 : -1;
+    zstd->framesize = (size_t)framesize << 20;
+    zstd->nframes = (nframes > 0) ? nframes : 1;
+    zstd->frames = frames;
+    zstd->windowlog = windowlog;
+    zstd->dictid = dictid;
+    if ((flags & O_ACCMODE) == O_RDONLY) {
+	zstd->memlimit = zstdMemLimit();
+	zstd->ddict = dict;
+    } else {
+	zstd->cdict = dict;
+    }
 
     return zstd;
 
 err:
     fclose(fp);
-    if ((flags & O_ACCMODE) == O_RDONLY)
+    if ((flags & O_ACCMODE) == O_RDONLY) {
 	ZSTD_freeDStream(_stream);
-    else
+	ZSTD_freeDDict(dict);
+    } else {
 	ZSTD_freeCCtx(_stream);
+	for (int i = 0; frames && i < nframes; i++)
+	    ZSTD_freeCCtx(frames[i].ctx);
+	free(frames);
+	ZSTD_freeCDict(dict);
+    }
     return NULL;
 }
 
@@ -1155,6 +2104,328 @@ static FD_t zstdFdopen(FD_t fd, int fdno, const char * fmode)
     return fd;
 }
 
+/* Compress all filled frames in parallel and write them out in order */
+static int zstdWriteFrames(FDSTACK_t fps, rpmzstd zstd)
+{
+    int nfilled = zstd->fcur;
+    int rc = 0;
+
+    if (nfilled < zstd->nframes && zstd->frames[nfilled].dsize > 0)
+	nfilled++;
+
+    #pragma omp parallel for num_threads(zstd->nframes) if (nfilled > 1)
+    for (int i = 0; i < nfilled; i++) {
+	zstdframe f = &zstd->frames[i];
+	if (f->cb == NULL) {
+	    f->cbsize = ZSTD_compressBound(zstd->framesize);
+	    f->cb = xmalloc(f->cbsize);
+	}
+	f->rc = ZSTD_compress2(f->ctx, f->cb, f->cbsize, f->db, f->dsize);
+    }
+
+    for (int i = 0; i < nfilled; i++) {
+	zstdframe f = &zstd->frames[i];
+	uint8_t idx[ZSTD_IDX_SIZE];
+
+	if (rc == 0 && ZSTD_isError(f->rc)) {
+	    fps->errcookie = ZSTD_getErrorName(f->rc);
+	    rc = -1;
+	}
+	if (rc == 0) {
+	    zstdPut32(idx, ZSTD_IDX_MAGIC);
+	    zstdPut32(idx+4, ZSTD_IDX_SIZE - 8);
+	    zstdPut32(idx+8, f->rc);
+	    zstdPut32(idx+12, f->dsize);
+	    if (fwrite(idx, 1, sizeof(idx), zstd->fp) != sizeof(idx) ||
+		fwrite(f->cb, 1, f->rc, zstd->fp) != f->rc) {
+		fps->errcookie = "zstdWrite fwrite failed.";
+		rc = -1;
+	    }
+	}
+	f->dsize = 0;
+    }
+    zstd->fcur = 0;
+    return rc;
+}
+
+static ssize_t zstdWriteFramed(FDSTACK_t fps, rpmzstd zstd,
+				const void * buf, size_t count)
+{
+    const uint8_t *b = buf;
+    size_t left = count;
+
+    while (left > 0) {
+	zstdframe f = &zstd->frames[zstd->fcur];
+	size_t n = zstd->framesize - f->dsize;
+
+	if (n > left)
+	    n = left;
+	if (f->db == NULL)
+	    f->db = xmalloc(zstd->framesize);
+	memcpy(f->db + f->dsize, b, n);
+	f->dsize += n;
+	b += n;
+	left -= n;
+
+	if (f->dsize == zstd->framesize) {
+	    if (++zstd->fcur == zstd->nframes && zstdWriteFrames(fps, zstd))
+		return -1;
+	}
+    }
+    return count;
+}
+
+/* Make sure the dictionary a frame was compressed with is loaded */
+static int zstdFrameDict(FDSTACK_t fps, rpmzstd zstd,
+			 const void *src, size_t srcsize)
+{
+    unsigned dictid = ZSTD_getDictID_fromFrame(src, srcsize);
+
+    if (dictid == 0 || dictid == zstd->dictid)
+	return 0;
+    if (zstd->ddict) {
+	fps->errcookie = "zstd: frames use different dictionaries";
+	return -1;
+    }
+    if ((zstd->ddict = zstdDictNew(dictid, 0, 0)) == NULL) {
+	fps->errcookie = "zstd: dictionary not available";
+	return -1;
+    }
+    zstd->dictid = dictid;
+    if (zstd->_stream &&
+	ZSTD_isError(ZSTD_DCtx_refDDict(zstd->_stream, zstd->ddict))) {
+	fps->errcookie = "zstd: dictionary not usable";
+	return -1;
+    }
+    return 0;
+}
+
+/* Read the next frame index, possibly already consumed by detection */
+static size_t zstdReadIndex(rpmzstd zstd, uint8_t *idx)
+{
+    size_t nr = 0;
+    if (zstd->zib.pos < zstd->zib.size) {
+	nr = zstd->zib.size - zstd->zib.pos;
+	if (nr > ZSTD_IDX_SIZE)
+	    nr = ZSTD_IDX_SIZE;
+	memcpy(idx, (const uint8_t *)zstd->zib.src + zstd->zib.pos, nr);
+	zstd->zib.pos += nr;
+    }
+    if (nr < ZSTD_IDX_SIZE)
+	nr += fread(idx + nr, 1, ZSTD_IDX_SIZE - nr, zstd->fp);
+    return nr;
+}
+
+/* Explain decoder errors caused by %_zstd_max_windowlog */
+static void zstdWindowError(rpmzstd zstd, size_t rc)
+{
+    if (ZSTD_getErrorCode(rc) == ZSTD_error_frameParameter_windowTooLarge) {
+	rpmlog(RPMLOG_ERR, _("zstd window is larger than the decoder "
+		"limit of 2^%d bytes set by %%_zstd_max_windowlog\n"),
+		zstd->windowlog);
+    }
+}
+
+/* Compressed data left in the underlying file, -1 if it can't be known */
+static off_t zstdRemaining(rpmzstd zstd)
+{
+    struct stat sb;
+    off_t pos;
+
+    if (fstat(fileno(zstd->fp), &sb) || !S_ISREG(sb.st_mode) ||
+	(pos = ftello(zstd->fp)) < 0)
+	return -1;
+    return (sb.st_size > pos) ? sb.st_size - pos : 0;
+}
+
+/* Drop the buffers of a frame, they're allocated again on next use */
+static void zstdFrameRelease(rpmzstd zstd, zstdframe f)
+{
+    zstd->memused -= f->cbsize + f->dbsize;
+    f->cb = _free(f->cb);
+    f->db = _free(f->db);
+    f->cbsize = f->dbsize = 0;
+}
+
+/* Memory needed to grow the buffers of a frame to its sizes */
+static size_t zstdFrameGrowth(zstdframe f)
+{
+    return (f->csize > f->cbsize ? f->csize - f->cbsize : 0) +
+	   (f->dsize > f->dbsize ? f->dsize - f->dbsize : 0);
+}
+
+/*
+ * Read up to nframes frames and decompress them in parallel. Fewer are
+ * read when their buffers would exceed the memory limit. Neither index
+ * sizes are trusted for allocating: the compressed size must be in the
+ * file and the decompressed size must be what the frame itself says.
+ */
+static int zstdReadFrames(FDSTACK_t fps, rpmzstd zstd)
+{
+    int nfilled = 0;
+
+    if (zstd->frames == NULL)
+	zstd->frames = xcalloc(zstd->nframes, sizeof(*zstd->frames));
+
+    zstd->nfilled = 0;
+    zstd->fcur = 0;
+    zstd->fpos = 0;
+
+    while (nfilled < zstd->nframes) {
+	zstdframe f = &zstd->frames[nfilled];
+	uint8_t *idx = zstd->idx;
+	size_t nr = ZSTD_IDX_SIZE;
+	off_t remaining;
+	unsigned long long fsize;
+
+	if (!zstd->haveidx)
+	    nr = zstdReadIndex(zstd, idx);
+	zstd->haveidx = 0;
+
+	if (nr == 0)
+	    break;		/* EOF */
+	if (nr != ZSTD_IDX_SIZE || !zstdIsIndex(idx)) {
+	    fps->errcookie = "zstd: invalid frame index";
+	    return -1;
+	}
+
+	f->csize = zstdGet32(idx+8);
+	f->dsize = zstdGet32(idx+12);
+	if (f->dsize > ((size_t)ZSTD_FRAME_MAX << 20) ||
+	    f->csize > ZSTD_compressBound(f->dsize)) {
+	    fps->errcookie = "zstd: invalid frame index";
+	    return -1;
+	}
+
+	remaining = zstdRemaining(zstd);
+	if (remaining >= 0 && f->csize > remaining) {
+	    fps->errcookie = "zstd: truncated frame";
+	    return -1;
+	}
+
+	/* Unused buffers of the later frames go first, then parallelism */
+	if (zstd->memused + zstdFrameGrowth(f) > zstd->memlimit) {
+	    for (int i = nfilled; i < zstd->nframes; i++)
+		zstdFrameRelease(zstd, &zstd->frames[i]);
+	}
+	if (zstd->memused + zstdFrameGrowth(f) > zstd->memlimit) {
+	    if (nfilled > 0) {
+		zstd->haveidx = 1;
+		break;
+	    }
+	    rpmlog(RPMLOG_ERR, _("zstd frame of %zu bytes exceeds the memory "
+		    "limit set by %%_zstd_memlimit\n"), f->csize + f->dsize);
+	    fps->errcookie = "zstd: memory limit exceeded";
+	    return -1;
+	}
+
+	if (f->csize > f->cbsize) {
+	    zstd->memused += f->csize - f->cbsize;
+	    f->cbsize = f->csize;
+	    f->cb = xrealloc(f->cb, f->cbsize);
+	}
+	if (f->ctx == NULL && (f->ctx = zstdDCtxNew(zstd->windowlog)) == NULL) {
+	    fps->errcookie = "zstd: out of memory";
+	    return -1;
+	}
+
+	if (fread(f->cb, 1, f->csize, zstd->fp) != f->csize) {
+	    fps->errcookie = "zstd: truncated frame";
+	    return -1;
+	}
+	fsize = ZSTD_getFrameContentSize(f->cb, f->csize);
+	if (fsize != ZSTD_CONTENTSIZE_UNKNOWN && fsize != f->dsize) {
+	    fps->errcookie = "zstd: frame size mismatch";
+	    return -1;
+	}
+	if (zstdFrameDict(fps, zstd, f->cb, f->csize))
+	    return -1;
+
+	if (f->dsize > f->dbsize) {
+	    zstd->memused += f->dsize - f->dbsize;
+	    f->dbsize = f->dsize;
+	    f->db = xrealloc(f->db, f->dbsize);
+	}
+	nfilled++;
+    }
+
+    #pragma omp parallel for num_threads(zstd->nframes) if (nfilled > 1)
+    for (int i = 0; i < nfilled; i++) {
+	zstdframe f = &zstd->frames[i];
+	if (zstd->ddict)
+	    f->rc = ZSTD_decompress_usingDDict(f->ctx, f->db, f->dsize,
+					       f->cb, f->csize, zstd->ddict);
+	else
+	    f->rc = ZSTD_decompressDCtx(f->ctx, f->db, f->dsize,
+					f->cb, f->csize);
+    }
+
+    for (int i = 0; i < nfilled; i++) {
+	zstdframe f = &zstd->frames[i];
+	if (ZSTD_isError(f->rc)) {
+	    zstdWindowError(zstd, f->rc);
+	    fps->errcookie = ZSTD_getErrorName(f->rc);
+	    return -1;
+	}
+	if (f->rc != f->dsize) {
+	    fps->errcookie = "zstd: frame size mismatch";
+	    return -1;
+	}
+    }
+
+    zstd->nfilled = nfilled;
+    return nfilled;
+}
+
+static ssize_t zstdReadFramed(FDSTACK_t fps, rpmzstd zstd,
+				void * buf, size_t count)
+{
+    uint8_t *b = buf;
+    size_t total = 0;
+
+    while (total < count) {
+	if (zstd->fcur >= zstd->nfilled) {
+	    int nfilled = zstdReadFrames(fps, zstd);
+	    if (nfilled < 0)
+		return -1;
+	    if (nfilled == 0)
+		break;		/* EOF */
+	}
+
+	zstdframe f = &zstd->frames[zstd->fcur];
+	size_t n = f->dsize - zstd->fpos;
+	if (n > count - total)
+	    n = count - total;
+	memcpy(b + total, f->db + zstd->fpos, n);
+	total += n;
+	zstd->fpos += n;
+
+	if (zstd->fpos == f->dsize) {
+	    zstd->fcur++;
+	    zstd->fpos = 0;
+	}
+    }
+    return total;
+}
+
+/* Peek at the stream start, leaving the data for whoever consumes it */
+static void zstdDetectFramed(rpmzstd zstd)
+{
+    size_t nr = 0;
+    uint8_t *b = zstd->b;
+
+    while (nr < ZSTD_IDX_SIZE) {
+	size_t n = fread(b + nr, 1, ZSTD_IDX_SIZE - nr, zstd->fp);
+	if (n == 0)
+	    break;
+	nr += n;
+    }
+    zstd->zib.src = zstd->b;
+    zstd->zib.size = nr;
+    zstd->zib.pos = 0;
+    zstd->framed = (nr == ZSTD_IDX_SIZE && zstdIsIndex(b));
+}
+
 static int zstdFlush(FDSTACK_t fps)
 {
     rpmzstd zstd = (rpmzstd) fps->fp;
@@ -1163,6 +2434,8 @@ assert(zstd);
 
     if ((zstd->flags & O_ACCMODE) == O_RDONLY) { /* decompressing */
 	rc = 0;
+    } else if (zstd->framed > 0) {		/* compressing frames */
+	rc = zstdWriteFrames(fps, zstd);
     } else {					/* compressing */
 	/* close frame */
 	int xx;
@@ -1193,6 +2466,15 @@ static ssize_t zstdRead(FDSTACK_t fps, void * buf, size_t count)
 assert(zstd);
     ZSTD_outBuffer zob = { buf, count, 0 };
 
+    if (zstd->framed < 0) {
+	zstdDetectFramed(zstd);
+	if (!zstd->framed &&
+	    zstdFrameDict(fps, zstd, zstd->zib.src, zstd->zib.size))
+	    return -1;
+    }
+    if (zstd->framed)
+	return zstdReadFramed(fps, zstd, buf, count);
+
     while (zob.pos < zob.size) {
 	/* Re-fill compressed data buffer. */
 	if (zstd->zib.pos >= zstd->zib.size) {
@@ -1206,6 +2488,7 @@ assert(zstd);
 	/* Decompress next chunk. */
 	int xx = ZSTD_decompressStream(zstd->_stream, &zob, &zstd->zib);
 	if (ZSTD_isError(xx)) {
+	    zstdWindowError(zstd, xx);
 	    fps->errcookie = ZSTD_getErrorName(xx);
 	    return -1;
 	}
@@ -1219,6 +2502,9 @@ static ssize_t zstdWrite(FDSTACK_t fps, const void * buf, size_t count)
 assert(zstd);
     ZSTD_inBuffer zib = { buf, count, 0 };
 
+    if (zstd->framed > 0)
+	return zstdWriteFramed(fps, zstd, buf, count);
+
     while (zib.pos < zib.size) {
 
 	/* Reset to beginning of compressed data buffer. */
@@ -1254,6 +2540,8 @@ assert(zstd);
     if ((zstd->flags & O_ACCMODE) == O_RDONLY) { /* decompressing */
 	rc = 0;
 	ZSTD_freeDStream(zstd->_stream);
+    } else if (zstd->framed > 0) {		/* compressing frames */
+	rc = zstdWriteFrames(fps, zstd);
     } else {					/* compressing */
 	/* close frame */
 	int xx;
@@ -1280,6 +2568,9 @@ assert(zstd);
     if (zstd->fp && fileno(zstd->fp) > 2)
 	(void) fclose(zstd->fp);
 
+    zstdFramesFree(zstd);
+    ZSTD_freeCDict(zstd->cdict);
+    ZSTD_freeDDict(zstd->ddict);
     if (zstd->b) free(zstd->b);
     free(zstd);
 
@@ -1295,6 +2586,663 @@ static const FDIO_t zstdio = &zstdio_s ;
 
 #endif	/* HAVE_ZSTD */
 
+/* =============================================================== */
+/* Support for LZ4 library.  */
+#ifdef HAVE_LZ4
+
+#include <lz4frame.h>
+
+#define LZ4_CHUNK	(64 * 1024)	/* input bytes per compression call */
+
+typedef struct rpmlz4_s {
+    int flags;			/*!< open flags. */
+    int fdno;
+    int level;			/*!< compression level */
+    FILE * fp;
+    void * ctx;			/*!< LZ4F_{c,d}ctx */
+    LZ4F_preferences_t prefs;
+    uint8_t * b;		/*!< compressed data buffer */
+    size_t nb;
+    size_t bpos;		/*!< read position in compressed data */
+    size_t blen;		/*!< amount of compressed data */
+    size_t hint;		/*!< decompressor hint, 0 at frame end */
+} * rpmlz4;
+
+static rpmlz4 rpmlz4New(int fdno, const char *fmode)
+{
+    int flags = 0;
+    int level = 1;
+    const char * s = fmode;
+    char stdio[32];
+    char *t = stdio;
+    char *te = t + sizeof(stdio) - 2;
+    int c;
+
+    switch ((c = *s++)) {
+    case 'a':
+	*t++ = (char)c;
+	flags &= ~O_ACCMODE;
+	flags |= O_WRONLY | O_CREAT | O_APPEND;
+	break;
+    case 'w':
+	*t++ = (char)c;
+	flags &= ~O_ACCMODE;
+	flags |= O_WRONLY | O_CREAT | O_TRUNC;
+	break;
+    case 'r':
+	*t++ = (char)c;
+	flags &= ~O_ACCMODE;
+	flags |= O_RDONLY;
+	break;
+    }
+
+    while ((c = *s++) != 0) {
+	switch (c) {
+	case '.':
+	    break;
+	case '+':
+	    if (t < te) *t++ = c;
+	    flags &= ~O_ACCMODE;
+	    flags |= O_RDWR;
+	    continue;
+	case 'T':
+	    /* lz4 is single threaded, accept and ignore thread counts */
+	    (void) strtol(s, (char **)&s, 10);
+	    continue;
+	default:
+	    if (c >= (int)'0' && c <= (int)'9') {
+		level = strtol(s-1, (char **)&s, 10);
+		if (level > LZ4F_compressionLevel_max()) {
+		    level = LZ4F_compressionLevel_max();
+		    rpmlog(RPMLOG_WARNING, "Invalid compression level for lz4. Using %i instead.\n", level);
+		}
+	    }
+	    continue;
+	}
+	break;
+    }
+    *t = '\0';
+
+    FILE * fp = fdopen(fdno, stdio);
+    if (fp == NULL)
+	return NULL;
+
+    rpmlz4 lz4 = xcalloc(1, sizeof(*lz4));
+    lz4->flags = flags;
+    lz4->fdno = fdno;
+    lz4->level = level;
+    lz4->fp = fp;
+
+    if ((flags & O_ACCMODE) == O_RDONLY) {	/* decompressing */
+	if (LZ4F_isError(LZ4F_createDecompressionContext(
+			    (LZ4F_dctx **)&lz4->ctx, LZ4F_VERSION)))
+	    goto err;
+	lz4->nb = LZ4_CHUNK;
+	lz4->b = xmalloc(lz4->nb);
+    } else {					/* compressing */
+	size_t rc;
+
+	lz4->prefs.compressionLevel = level;
+	lz4->prefs.frameInfo.blockSizeID = LZ4F_max256KB;
+	lz4->prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+	if (LZ4F_isError(LZ4F_createCompressionContext(
+			    (LZ4F_cctx **)&lz4->ctx, LZ4F_VERSION)))
+	    goto err;
+	lz4->nb = LZ4F_compressBound(LZ4_CHUNK, &lz4->prefs);
+	if (lz4->nb < LZ4F_HEADER_SIZE_MAX)
+	    lz4->nb = LZ4F_HEADER_SIZE_MAX;
+	lz4->b = xmalloc(lz4->nb);
+
+	/* Write the frame header right away, even empty data needs it */
+	rc = LZ4F_compressBegin(lz4->ctx, lz4->b, lz4->nb, &lz4->prefs);
+	if (LZ4F_isError(rc) || fwrite(lz4->b, 1, rc, fp) != rc)
+	    goto err;
+    }
+
+    return lz4;
+
+err:
+    fclose(fp);
+    if ((flags & O_ACCMODE) == O_RDONLY)
+	LZ4F_freeDecompressionContext(lz4->ctx);
+    else
+	LZ4F_freeCompressionContext(lz4->ctx);
+    free(lz4->b);
+    free(lz4);
+    return NULL;
+}
+
+static FD_t lz4Fdopen(FD_t fd, int fdno, const char * fmode)
+{
+    rpmlz4 lz4 = rpmlz4New(fdno, fmode);
+
+    if (lz4 == NULL)
+	return NULL;
+
+    fdSetFdno(fd, -1);		/* XXX skip the fdio close */
+    fdPush(fd, lz4dio, lz4, fdno);		/* Push lz4dio onto stack */
+    return fd;
+}
+
+/* Write out compressor output from the buffer */
+static int lz4Out(FDSTACK_t fps, rpmlz4 lz4, size_t rc)
+{
+    if (LZ4F_isError(rc)) {
+	fps->errcookie = LZ4F_getErrorName(rc);
+	return -1;
+    }
+    if (rc > 0 && fwrite(lz4->b, 1, rc, lz4->fp) != rc) {
+	fps->errcookie = "lz4Write fwrite failed.";
+	return -1;
+    }
+    return 0;
+}
+
+static int lz4Flush(FDSTACK_t fps)
+{
+    rpmlz4 lz4 = (rpmlz4) fps->fp;
+assert(lz4);
+
+    if ((lz4->flags & O_ACCMODE) == O_RDONLY) /* decompressing */
+	return 0;
+
+    return lz4Out(fps, lz4, LZ4F_flush(lz4->ctx, lz4->b, lz4->nb, NULL));
+}
+
+static ssize_t lz4Read(FDSTACK_t fps, void * buf, size_t count)
+{
+    rpmlz4 lz4 = (rpmlz4) fps->fp;
+assert(lz4);
+    uint8_t *ob = buf;
+    size_t opos = 0;
+
+    while (opos < count) {
+	/* Re-fill compressed data buffer. */
+	if (lz4->bpos >= lz4->blen) {
+	    lz4->blen = fread(lz4->b, 1, lz4->nb, lz4->fp);
+	    lz4->bpos = 0;
+	    if (lz4->blen == 0) {
+		/* EOF, but was it the end of a frame? */
+		if (lz4->hint != 0) {
+		    fps->errcookie = "lz4 payload truncated";
+		    return -1;
+		}
+		break;
+	    }
+	}
+
+	/* Decompress next chunk. Concatenated frames are handled too. */
+	size_t osize = count - opos;
+	size_t isize = lz4->blen - lz4->bpos;
+	size_t rc = LZ4F_decompress(lz4->ctx, ob + opos, &osize,
+				    lz4->b + lz4->bpos, &isize, NULL);
+	if (LZ4F_isError(rc)) {
+	    fps->errcookie = LZ4F_getErrorName(rc);
+	    return -1;
+	}
+	lz4->hint = rc;
+	lz4->bpos += isize;
+	opos += osize;
+    }
+    return opos;
+}
+
+static ssize_t lz4Write(FDSTACK_t fps, const void * buf, size_t count)
+{
+    rpmlz4 lz4 = (rpmlz4) fps->fp;
+assert(lz4);
+    const uint8_t *ib = buf;
+    size_t ipos = 0;
+
+    while (ipos < count) {
+	size_t n = count - ipos;
+	if (n > LZ4_CHUNK)
+	    n = LZ4_CHUNK;
+
+	/* Compress next chunk and write out whatever got produced. */
+	size_t rc = LZ4F_compressUpdate(lz4->ctx, lz4->b, lz4->nb,
+					ib + ipos, n, NULL);
+	if (lz4Out(fps, lz4, rc))
+	    return -1;
+	ipos += n;
+    }
+    return ipos;
+}
+
+static int lz4Close(FDSTACK_t fps)
+{
+    rpmlz4 lz4 = (rpmlz4) fps->fp;
+assert(lz4);
+    int rc = 0;
+
+    if ((lz4->flags & O_ACCMODE) == O_RDONLY) { /* decompressing */
+	LZ4F_freeDecompressionContext(lz4->ctx);
+    } else {					/* compressing */
+	/* close frame */
+	rc = lz4Out(fps, lz4, LZ4F_compressEnd(lz4->ctx, lz4->b, lz4->nb, NULL));
+	LZ4F_freeCompressionContext(lz4->ctx);
+    }
+
+    if (lz4->fp && fileno(lz4->fp) > 2)
+	(void) fclose(lz4->fp);
+
+    free(lz4->b);
+    free(lz4);
+
+    return rc;
+}
+
+static const struct FDIO_s lz4dio_s = {
+  "lz4dio", "lz4",
+  lz4Read, lz4Write, NULL, lz4Close,
+  NULL, lz4Fdopen, lz4Flush, NULL, zfdError, zfdStrerr
+};
+static const FDIO_t lz4dio = &lz4dio_s ;
+
+#endif	/* HAVE_LZ4 */
+
+/* =============================================================== */
+/*
+ * Asynchronous read-ahead: a producer thread reads (and thus eg.
+ * decompresses) from the layer below into a ring of large buffers,
+ * while the reader drains them on its own thread.
+ */
+#include <pthread.h>
+
+#define AHEAD_BUFSIZE	(1024 * 1024)
+#define AHEAD_NBUFS	4
+
+typedef struct aheadbuf_s {
+    uint8_t * b;
+    size_t len;
+} * aheadbuf;
+
+typedef struct rpmahead_s {
+    FDSTACK_t src;		/*!< layer to read from */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int nbufs;
+    aheadbuf bufs;
+    int head;			/*!< next buffer to fill */
+    int tail;			/*!< next buffer to drain */
+    int nfull;			/*!< no. of filled buffers */
+    size_t pos;			/*!< read position in tail buffer */
+    int eof;
+    int err;
+    int stop;
+} * rpmahead;
+
+/* Fill a buffer from the source layer, returns -1 on error */
+static ssize_t aheadFill(rpmahead ah, uint8_t *b, size_t size, size_t *nread)
+{
+    FDSTACK_t src = ah->src;
+    ssize_t rc = 0;
+
+    *nread = 0;
+    while (*nread < size) {
+	do {
+	    rc = src->io->read(src, b + *nread, size - *nread);
+	} while (rc == -1 && errno == EINTR);
+	if (rc <= 0)
+	    break;
+	*nread += rc;
+    }
+    return rc;
+}
+
+static void * aheadProducer(void *arg)
+{
+    rpmahead ah = arg;
+
+    pthread_mutex_lock(&ah->lock);
+    while (!ah->stop && !ah->eof && !ah->err) {
+	if (ah->nfull == ah->nbufs) {
+	    pthread_cond_wait(&ah->cond, &ah->lock);
+	    continue;
+	}
+
+	/* The head buffer is ours alone until it's marked full */
+	aheadbuf ab = &ah->bufs[ah->head];
+	size_t nread = 0;
+	pthread_mutex_unlock(&ah->lock);
+	ssize_t rc = aheadFill(ah, ab->b, AHEAD_BUFSIZE, &nread);
+	pthread_mutex_lock(&ah->lock);
+
+	ab->len = nread;
+	if (nread > 0) {
+	    ah->head = (ah->head + 1) % ah->nbufs;
+	    ah->nfull++;
+	}
+	if (rc < 0)
+	    ah->err = 1;
+	else if (nread < AHEAD_BUFSIZE)
+	    ah->eof = 1;
+	pthread_cond_broadcast(&ah->cond);
+    }
+    pthread_mutex_unlock(&ah->lock);
+    return NULL;
+}
+
+static FD_t aheadFdopen(FD_t fd, int fdno, const char * fmode)
+{
+    rpmahead ah;
+    int nbufs = AHEAD_NBUFS;
+
+    if (*fmode != 'r')
+	return NULL;
+    for (const char *s = fmode; *s; s++) {
+	if (*s >= '0' && *s <= '9') {
+	    nbufs = strtol(s, (char **)&s, 10);
+	    break;
+	}
+    }
+    if (nbufs < 2)
+	nbufs = 2;
+
+    ah = xcalloc(1, sizeof(*ah));
+    ah->src = fdGetFps(fd);
+    ah->nbufs = nbufs;
+    ah->bufs = xcalloc(nbufs, sizeof(*ah->bufs));
+    for (int i = 0; i < nbufs; i++)
+	ah->bufs[i].b = xmalloc(AHEAD_BUFSIZE);
+    pthread_mutex_init(&ah->lock, NULL);
+    pthread_cond_init(&ah->cond, NULL);
+
+    /* Without a thread, just carry on reading synchronously */
+    if (pthread_create(&ah->thread, NULL, aheadProducer, ah)) {
+	rpmlog(RPMLOG_DEBUG, "read-ahead thread creation failed\n");
+	pthread_mutex_destroy(&ah->lock);
+	pthread_cond_destroy(&ah->cond);
+	for (int i = 0; i < nbufs; i++)
+	    free(ah->bufs[i].b);
+	free(ah->bufs);
+	free(ah);
+	return fd;
+    }
+
+    /* The source layer needs closing too, so keep its fdno intact */
+    fdPush(fd, aheadio, ah, fdno);
+    return fd;
+}
+
+static ssize_t aheadRead(FDSTACK_t fps, void * buf, size_t count)
+{
+    rpmahead ah = fps->fp;
+    uint8_t *b = buf;
+    size_t total = 0;
+    int err = 0;
+
+    pthread_mutex_lock(&ah->lock);
+    while (total < count) {
+	if (ah->nfull == 0) {
+	    if (ah->eof || ah->err)
+		break;
+	    pthread_cond_wait(&ah->cond, &ah->lock);
+	    continue;
+	}
+
+	/* The tail buffer is ours alone until it's marked empty */
+	aheadbuf ab = &ah->bufs[ah->tail];
+	size_t n = ab->len - ah->pos;
+	if (n > count - total)
+	    n = count - total;
+	pthread_mutex_unlock(&ah->lock);
+	memcpy(b + total, ab->b + ah->pos, n);
+	pthread_mutex_lock(&ah->lock);
+
+	total += n;
+	ah->pos += n;
+	if (ah->pos == ab->len) {
+	    ah->pos = 0;
+	    ah->tail = (ah->tail + 1) % ah->nbufs;
+	    ah->nfull--;
+	    pthread_cond_broadcast(&ah->cond);
+	}
+    }
+    if (total == 0 && ah->err)
+	err = 1;
+    pthread_mutex_unlock(&ah->lock);
+
+    return err ? -1 : total;
+}
+
+static int aheadClose(FDSTACK_t fps)
+{
+    rpmahead ah = fps->fp;
+
+    if (ah == NULL) return -2;
+
+    pthread_mutex_lock(&ah->lock);
+    ah->stop = 1;
+    pthread_cond_broadcast(&ah->cond);
+    pthread_mutex_unlock(&ah->lock);
+    pthread_join(ah->thread, NULL);
+
+    pthread_mutex_destroy(&ah->lock);
+    pthread_cond_destroy(&ah->cond);
+    for (int i = 0; i < ah->nbufs; i++)
+	free(ah->bufs[i].b);
+    free(ah->bufs);
+    free(ah);
+
+    return 0;
+}
+
+static int aheadError(FDSTACK_t fps)
+{
+    rpmahead ah = fps->fp;
+    int err;
+
+    pthread_mutex_lock(&ah->lock);
+    err = ah->err ? -1 : 0;
+    pthread_mutex_unlock(&ah->lock);
+    return err;
+}
+
+static const char * aheadStrerr(FDSTACK_t fps)
+{
+    rpmahead ah = fps->fp;
+    const char *err = "";
+
+    /* The producer is done after an error, the source is ours again */
+    if (aheadError(fps) && ah->src->io && ah->src->io->_fstrerr)
+	err = ah->src->io->_fstrerr(ah->src);
+    return err;
+}
+
+static const struct FDIO_s aheadio_s = {
+  "aheadio", NULL,
+  aheadRead, NULL, NULL, aheadClose,
+  NULL, aheadFdopen, fdFlush, NULL, aheadError, aheadStrerr
+};
+static const FDIO_t aheadio = &aheadio_s ;
+
+/* =============================================================== */
+/*
+ * Read buffering: small reads, such as those of package leads and
+ * header intros, are served from a buffer filled in large chunks.
+ * Only seekable descriptors are buffered, so the layer can be dropped
+ * again leaving the descriptor at the logical read position.
+ */
+#define BUF_DEFAULT	(64 * 1024)
+
+typedef struct rpmbuf_s {
+    FDSTACK_t src;		/*!< layer to read from */
+    uint8_t * b;
+    size_t nb;			/*!< buffer size */
+    size_t blen;		/*!< no. of bytes in buffer */
+    size_t bpos;		/*!< read position in buffer */
+    off_t boff;			/*!< source offset of buffer start */
+} * rpmbuf;
+
+static int bufPush(FD_t fd, size_t nb)
+{
+    FDSTACK_t src = fdGetFps(fd);
+    rpmbuf bf;
+    off_t off;
+
+    if (src == NULL || src->io == bufio || nb == 0)
+	return 0;
+    if (src->io->seek == NULL || src->io->_ftell == NULL ||
+	(off = src->io->_ftell(src)) < 0)
+	return 0;
+
+    bf = xcalloc(1, sizeof(*bf));
+    bf->src = src;
+    bf->nb = nb;
+    bf->b = xmalloc(nb);
+    bf->boff = off;
+
+    /* The source layer needs closing too, so keep its fdno intact */
+    fdPush(fd, bufio, bf, src->fdno);
+    return 1;
+}
+
+static FD_t bufFdopen(FD_t fd, int fdno, const char * fmode)
+{
+    size_t nb = BUF_DEFAULT;
+
+    if (*fmode != 'r')
+	return NULL;
+    for (const char *s = fmode; *s; s++) {
+	if (*s >= '0' && *s <= '9') {
+	    nb = strtoul(s, (char **)&s, 10);
+	    break;
+	}
+    }
+
+    /* Unseekable descriptors are read as they are */
+    (void) bufPush(fd, nb);
+    return fd;
+}
+
+static ssize_t bufRead(FDSTACK_t fps, void * buf, size_t count)
+{
+    rpmbuf bf = fps->fp;
+    FDSTACK_t src = bf->src;
+    uint8_t *b = buf;
+    size_t total = 0;
+
+    while (total < count) {
+	size_t want = count - total;
+	ssize_t nr;
+
+	if (bf->bpos < bf->blen) {
+	    size_t n = bf->blen - bf->bpos;
+	    if (n > want)
+		n = want;
+	    memcpy(b + total, bf->b + bf->bpos, n);
+	    bf->bpos += n;
+	    total += n;
+	    continue;
+	}
+
+	/* A short fill means EOF on a regular file, save asking again */
+	if (bf->blen > 0 && bf->blen < bf->nb)
+	    break;
+
+	bf->boff += bf->blen;
+	bf->blen = bf->bpos = 0;
+
+	if (want >= bf->nb) {
+	    /* Large reads go straight to the caller */
+	    nr = src->io->read(src, b + total, want);
+	    if (nr > 0) {
+		bf->boff += nr;
+		total += nr;
+	    }
+	    if (nr >= 0 && (size_t)nr < want)
+		break;
+	} else {
+	    nr = src->io->read(src, bf->b, bf->nb);
+	    if (nr > 0)
+		bf->blen = nr;
+	}
+	if (nr < 0)
+	    return (total > 0) ? total : -1;
+	if (nr == 0)
+	    break;		/* EOF */
+    }
+    return total;
+}
+
+static int bufSeek(FDSTACK_t fps, off_t pos, int whence)
+{
+    rpmbuf bf = fps->fp;
+    FDSTACK_t src = bf->src;
+    off_t off;
+
+    if (whence == SEEK_CUR) {
+	pos += bf->boff + bf->bpos;
+	whence = SEEK_SET;
+    }
+
+    /* Seeks within the buffer need not bother the source */
+    if (whence == SEEK_SET && pos >= bf->boff && pos <= bf->boff + bf->blen) {
+	bf->bpos = pos - bf->boff;
+	return 0;
+    }
+
+    if (src->io->seek(src, pos, whence))
+	return -1;
+    off = (whence == SEEK_SET) ? pos : src->io->_ftell(src);
+    if (off < 0)
+	return -1;
+    bf->boff = off;
+    bf->blen = bf->bpos = 0;
+    return 0;
+}
+
+static off_t bufTell(FDSTACK_t fps)
+{
+    rpmbuf bf = fps->fp;
+    return bf->boff + bf->bpos;
+}
+
+static int bufClose(FDSTACK_t fps)
+{
+    rpmbuf bf = fps->fp;
+
+    if (bf == NULL) return -2;
+
+    free(bf->b);
+    free(bf);
+    fps->fp = NULL;
+    return 0;
+}
+
+static const struct FDIO_s bufio_s = {
+  "bufio", NULL,
+  bufRead, NULL, bufSeek, bufClose,
+  NULL, bufFdopen, fdFlush, bufTell, fdError, fdStrerr
+};
+static const FDIO_t bufio = &bufio_s ;
+
+int fdPushBuffer(FD_t fd, size_t size)
+{
+    return bufPush(fd, size);
+}
+
+int fdPopBuffer(FD_t fd)
+{
+    FDSTACK_t fps = fdGetFps(fd);
+    rpmbuf bf;
+    int rc = 0;
+
+    if (fps == NULL || fps->io != bufio)
+	return 0;
+
+    /* Give back whatever was read ahead of the caller */
+    bf = fps->fp;
+    if (bf->bpos < bf->blen)
+	rc = bf->src->io->seek(bf->src, bf->boff + bf->bpos, SEEK_SET);
+
+    bufClose(fps);
+    fdPop(fd);
+    return rc;
+}
+
 /* =============================================================== */
 
 #define	FDIOVEC(_fps, _vec)	\
@@ -1514,6 +3462,11 @@ static FDIO_t findIOT(const char *name)
 #ifdef HAVE_ZSTD
 	&zstdio_s,
 #endif
+#ifdef HAVE_LZ4
+	&lz4dio_s,
+#endif
+	&aheadio_s,
+	&bufio_s,
 	NULL
     };
     FDIO_t iot = NULL;
@@ -31,6 +31,37 @@ void fdFiniDigest(FD_t fd, int id,
 
 DIGEST_CTX fdDupDigest(FD_t fd, int id);
 
+/** \ingroup rpmio
+ * Copy data between plain descriptors within the kernel (zero-copy).
+ * Digests attached to either descriptor are updated from a mapping of
+ * the source, which must then be a regular file and the length known.
+ * Copying stops early when no kernel method applies to the descriptors,
+ * the caller is expected to copy the remainder by other means.
+ * @param sfd		source file handle
+ * @param tfd		target file handle
+ * @param len		no. of bytes to copy (-1 for until EOF)
+ * @return		no. of bytes copied, -1 on error
+ */
+off_t fdCopy(FD_t sfd, FD_t tfd, off_t len);
+
+/** \ingroup rpmio
+ * Buffer reads on fd, turning many small reads into a few large ones.
+ * Only seekable descriptors are buffered, others are left alone.
+ * The same is available as Fdopen(fd, "r<size>.bufio").
+ * @param fd		file handle
+ * @param size		buffer size in bytes
+ * @return		1 if a buffer was pushed, 0 otherwise
+ */
+int fdPushBuffer(FD_t fd, size_t size);
+
+/** \ingroup rpmio
+ * Drop a read buffer from the top of fd, returning the descriptor to
+ * the logical read position for whoever uses it (or its dup) next.
+ * @param fd		file handle
+ * @return		0 on success (or when not buffered), -1 on error
+ */
+int fdPopBuffer(FD_t fd);
+
 /**
  * Read an entire file into a buffer.
  * @param fn		file name to read
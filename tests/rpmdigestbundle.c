@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <rpm/rpmcrypto.h>
+
+static const int algos[] = {
+    RPM_HASH_MD5, RPM_HASH_SHA1, RPM_HASH_SHA256, RPM_HASH_SHA512,
+};
+#define NALGOS (sizeof(algos) / sizeof(algos[0]))
+
+static rpmDigestBundle bundleNew(void)
+{
+    rpmDigestBundle bundle = rpmDigestBundleNew();
+    for (size_t i = 0; i < NALGOS; i++)
+	rpmDigestBundleAdd(bundle, algos[i], RPMDIGEST_NONE);
+    return bundle;
+}
+
+/* Compare all digests of a bundle against sequentially computed ones */
+static int bundleCompare(const char *name,
+			 rpmDigestBundle seq, rpmDigestBundle vec)
+{
+    int rc = 0;
+    for (size_t i = 0; i < NALGOS; i++) {
+	char *s = NULL, *v = NULL;
+	rpmDigestBundleFinal(seq, algos[i], (void **)&s, NULL, 1);
+	rpmDigestBundleFinal(vec, algos[i], (void **)&v, NULL, 1);
+	if (s == NULL || v == NULL || strcmp(s, v)) {
+	    printf("%s: digest %d mismatch: %s != %s\n", name, algos[i],
+		   s ? s : "(null)", v ? v : "(null)");
+	    rc = 1;
+	}
+	free(s);
+	free(v);
+    }
+    rpmDigestBundleFree(seq);
+    rpmDigestBundleFree(vec);
+    return rc;
+}
+
+static int checkUpdateV(const char *name, const struct iovec *iov, int iovcnt)
+{
+    rpmDigestBundle seq = bundleNew();
+    rpmDigestBundle vec = bundleNew();
+    int rc = 0;
+
+    for (int i = 0; i < iovcnt; i++)
+	rc |= rpmDigestBundleUpdate(seq, iov[i].iov_base, iov[i].iov_len);
+    rc |= rpmDigestBundleUpdateV(vec, iov, iovcnt);
+    if (rc)
+	printf("%s: update failed\n", name);
+    return bundleCompare(name, seq, vec) || rc;
+}
+
+int main(void)
+{
+    size_t size = 1024 * 1024;
+    unsigned char *buf = malloc(size);
+    int rc = 0;
+
+    if (buf == NULL || rpmInitCrypto())
+	return 1;
+    for (size_t i = 0; i < size; i++)
+	buf[i] = (i * 2654435761U) >> 13;
+
+    /* Small inputs are hashed sequentially */
+    struct iovec small[] = {
+	{ buf, 13 }, { buf + 13, 0 }, { buf + 13, 4096 },
+    };
+    rc |= checkUpdateV("small", small, 3);
+
+    /* Large inputs are hashed in all contexts at once */
+    struct iovec large[] = {
+	{ buf, 100 }, { buf + 100, size / 2 }, { buf + 100, 0 },
+	{ buf + 100 + size / 2, size / 2 - 100 },
+    };
+    rc |= checkUpdateV("large", large, 4);
+
+    /* A bundle without any digests is fine too */
+    rpmDigestBundle empty = rpmDigestBundleNew();
+    if (rpmDigestBundleUpdateV(empty, large, 4)) {
+	printf("empty: update failed\n");
+	rc = 1;
+    }
+    rpmDigestBundleFree(empty);
+
+    free(buf);
+    return rc;
+}
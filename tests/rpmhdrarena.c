@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <rpm/header.h>
+#include <rpm/rpmtag.h>
+#include <rpm/rpmtd.h>
+
+/* Per header arena limit, see ARENA_MAX_SIZE in lib/header.c */
+#define ARENA_MAX	(256 * 1024)
+
+#define NSTRINGS	40
+#define STRLEN		999
+
+static int failures = 0;
+
+#define CHECK(_cond) \
+    do { if (!(_cond)) { \
+	printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #_cond); \
+	failures++; \
+    } } while (0)
+
+/* Together about 400k of string arrays and 40k of integers */
+static const rpmTagVal tags[] = {
+    RPMTAG_BASENAMES, RPMTAG_DIRNAMES, RPMTAG_PROVIDENAME,
+    RPMTAG_REQUIRENAME, RPMTAG_CONFLICTNAME, RPMTAG_OBSOLETENAME,
+    RPMTAG_FILEUSERNAME, RPMTAG_FILEGROUPNAME, RPMTAG_FILELINKTOS,
+    RPMTAG_FILELANGS, RPMTAG_FILESIZES, RPMTAG_NAME,
+};
+#define NTAGS	(sizeof(tags) / sizeof(tags[0]))
+
+static Header newHeader(void)
+{
+    Header h = headerNew();
+    const char *strs[NSTRINGS];
+    uint32_t sizes[10000];
+
+    for (int i = 0; i < NSTRINGS; i++) {
+	char *s = malloc(STRLEN + 1);
+	memset(s, 'a' + i % 26, STRLEN);
+	s[STRLEN] = '\0';
+	strs[i] = s;
+    }
+    for (int i = 0; i < NTAGS; i++) {
+	if (tags[i] != RPMTAG_FILESIZES && tags[i] != RPMTAG_NAME)
+	    headerPutStringArray(h, tags[i], strs, NSTRINGS);
+    }
+    for (int i = 0; i < NSTRINGS; i++)
+	free((char *) strs[i]);
+
+    for (int i = 0; i < 10000; i++)
+	sizes[i] = i;
+    headerPutUint32(h, RPMTAG_FILESIZES, sizes, 10000);
+    headerPutString(h, RPMTAG_NAME, "arena");
+    return h;
+}
+
+static int tdSame(rpmtd a, rpmtd b)
+{
+    if (a->type != b->type || rpmtdCount(a) != rpmtdCount(b))
+	return 0;
+    if (rpmtdClass(a) == RPM_STRING_CLASS) {
+	while (rpmtdNext(a) >= 0 && rpmtdNext(b) >= 0) {
+	    if (strcmp(rpmtdGetString(a), rpmtdGetString(b)))
+		return 0;
+	}
+	return 1;
+    }
+    return (memcmp(a->data, b->data, a->size) == 0);
+}
+
+/* Get all tags from the arena, the limit must make some use malloc */
+static void getAll(Header h, int *narena, int *nalloced, size_t *arenasize)
+{
+    for (int i = 0; i < NTAGS; i++) {
+	struct rpmtd_s td, ref;
+
+	CHECK(headerGet(h, tags[i], &td, HEADERGET_ALLOC | HEADERGET_ARENA));
+	CHECK(headerGet(h, tags[i], &ref, HEADERGET_MINMEM));
+	CHECK(td.data != NULL && tdSame(&td, &ref));
+
+	if (td.flags & RPMTD_ALLOCED) {
+	    (*nalloced)++;
+	} else {
+	    (*narena)++;
+	    *arenasize += td.size;
+	}
+	/* Leaves arena memory alone, headerFree() releases it */
+	rpmtdFreeData(&td);
+	rpmtdFreeData(&ref);
+    }
+}
+
+static long maxRSS(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+int main(void)
+{
+    Header h = newHeader();
+    int narena = 0, nalloced = 0;
+    size_t arenasize = 0;
+    unsigned int size = 0;
+    void *blob;
+    long rss;
+
+    /* Past the limit data falls back to malloc, arena use stays bounded */
+    getAll(h, &narena, &nalloced, &arenasize);
+    CHECK(narena > 0);
+    CHECK(nalloced > 0);
+    CHECK(arenasize <= ARENA_MAX);
+
+    /* Once full, everything but the smallest bits comes from malloc */
+    narena = nalloced = 0;
+    getAll(h, &narena, &nalloced, &arenasize);
+    CHECK(nalloced >= NTAGS - 1);
+    CHECK(arenasize <= ARENA_MAX);
+
+    blob = headerExport(h, &size);
+    headerFree(h);
+    CHECK(blob != NULL);
+    if (blob == NULL)
+	return 1;
+
+    /*
+     * Headers filling their arena over and over, freeing them must free
+     * the arena too. Leaking it would take well over 100MB here.
+     */
+    rss = maxRSS();
+    for (int i = 0; i < 512; i++) {
+	h = headerImport(blob, size, HEADERIMPORT_COPY);
+	narena = nalloced = 0;
+	arenasize = 0;
+	getAll(h, &narena, &nalloced, &arenasize);
+	headerFree(h);
+    }
+    /* ASAN quarantine grows RSS, its leak checker covers this there */
+#if !defined(__SANITIZE_ADDRESS__)
+    CHECK(maxRSS() - rss < 32 * 1024);
+#endif
+
+    free(blob);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,83 @@
+/*
+ * Time header tag retrieval over an rpmdb scan, roughly in the way the
+ * transaction element and dependency setup paths do it.
+ *
+ * Usage: rpmhdrbench [root [passes]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <rpm/rpmlib.h>
+#include <rpm/rpmdb.h>
+#include <rpm/rpmts.h>
+#include <rpm/header.h>
+
+static const rpmTagVal tags[] = {
+    RPMTAG_NAME, RPMTAG_EPOCH, RPMTAG_VERSION, RPMTAG_RELEASE,
+    RPMTAG_ARCH, RPMTAG_OS, RPMTAG_SIZE, RPMTAG_LONGSIZE,
+    RPMTAG_INSTALLTIME, RPMTAG_SOURCERPM, RPMTAG_HEADERCOLOR,
+    RPMTAG_BASENAMES, RPMTAG_DIRNAMES, RPMTAG_DIRINDEXES,
+    RPMTAG_FILESIZES, RPMTAG_FILEMODES, RPMTAG_FILEFLAGS,
+    RPMTAG_FILECOLORS, RPMTAG_FILEDIGESTS, RPMTAG_FILEDIGESTALGO,
+    RPMTAG_PROVIDENAME, RPMTAG_PROVIDEVERSION, RPMTAG_PROVIDEFLAGS,
+    RPMTAG_REQUIRENAME, RPMTAG_REQUIREVERSION, RPMTAG_REQUIREFLAGS,
+    RPMTAG_CONFLICTNAME, RPMTAG_OBSOLETENAME, RPMTAG_RECOMMENDNAME,
+    RPMTAG_SUGGESTNAME, RPMTAG_SUPPLEMENTNAME, RPMTAG_ENHANCENAME,
+    RPMTAG_ORDERNAME, RPMTAG_FILETRIGGERNAME, RPMTAG_TRANSFILETRIGGERNAME,
+    RPMTAG_PAYLOADFORMAT, RPMTAG_PAYLOADCOMPRESSOR,
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *root = (argc > 1) ? argv[1] : "/";
+    int passes = (argc > 2) ? atoi(argv[2]) : 100;
+    int ntags = sizeof(tags) / sizeof(tags[0]);
+    unsigned long nhdrs = 0, ngets = 0, nfound = 0;
+    rpmdbMatchIterator mi;
+    Header h;
+    rpmts ts;
+    double start, elapsed = 0;
+    int rc = EXIT_FAILURE;
+
+    if (rpmReadConfigFiles(NULL, NULL))
+	return rc;
+
+    ts = rpmtsCreate();
+    if (rpmtsSetRootDir(ts, root))
+	goto exit;
+
+    mi = rpmtsInitIterator(ts, RPMDBI_PACKAGES, NULL, 0);
+    while ((h = rpmdbNextIterator(mi)) != NULL) {
+	start = now();
+	for (int p = 0; p < passes; p++) {
+	    for (int i = 0; i < ntags; i++) {
+		struct rpmtd_s td;
+		if (headerGet(h, tags[i], &td, HEADERGET_MINMEM))
+		    nfound++;
+		rpmtdFreeData(&td);
+		ngets++;
+	    }
+	}
+	elapsed += now() - start;
+	nhdrs++;
+    }
+    rpmdbFreeIterator(mi);
+
+    printf("%lu headers, %lu lookups (%lu found) in %.3fs, %.1f ns/lookup\n",
+	   nhdrs, ngets, nfound, elapsed,
+	   ngets ? elapsed * 1e9 / ngets : 0.0);
+    rc = EXIT_SUCCESS;
+
+exit:
+    rpmtsFree(ts);
+    rpmFreeRpmrc();
+    return rc;
+}
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rpm/header.h>
+#include <rpm/rpmtag.h>
+#include <rpm/rpmtd.h>
+
+static int failures = 0;
+
+#define CHECK(_cond) \
+    do { if (!(_cond)) { \
+	printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #_cond); \
+	failures++; \
+    } } while (0)
+
+/* Exports of the kept and the freshly imported header must be identical */
+static void checkSame(const char *step, Header kept, Header fresh)
+{
+    unsigned int ksize = 0, fsize = 0;
+    void *kblob = headerExport(kept, &ksize);
+    void *fblob = headerExport(fresh, &fsize);
+
+    if (!(kblob && fblob && ksize == fsize && !memcmp(kblob, fblob, ksize))) {
+	printf("%s: exports differ (%u vs %u bytes)\n", step, ksize, fsize);
+	failures++;
+    }
+    free(kblob);
+    free(fblob);
+}
+
+static void modUint32(Header h, rpmTagVal tag, uint32_t val)
+{
+    struct rpmtd_s td;
+
+    rpmtdReset(&td);
+    td.tag = tag;
+    td.type = RPM_INT32_TYPE;
+    td.count = 1;
+    td.data = &val;
+    CHECK(headerMod(h, &td) == 1);
+}
+
+static void checkKeep(void *blob, unsigned int size)
+{
+    Header kept = headerImport(blob, size, HEADERIMPORT_COPY | HEADERIMPORT_KEEP);
+    Header fresh = headerImport(blob, size, HEADERIMPORT_COPY);
+    unsigned int xsize = 0;
+    void *xblob;
+    uint32_t val = 42;
+
+    CHECK(kept != NULL && fresh != NULL);
+    if (kept == NULL || fresh == NULL)
+	goto exit;
+
+    /* Unmodified, both export what was imported, dribbles included */
+    xblob = headerExport(kept, &xsize);
+    CHECK(xblob && xsize == size && !memcmp(xblob, blob, size));
+    free(xblob);
+    checkSame("import", kept, fresh);
+
+    /* Added entries go after the kept region, in tag order */
+    CHECK(headerPutString(kept, RPMTAG_URL, "https://rpm.org"));
+    CHECK(headerPutString(fresh, RPMTAG_URL, "https://rpm.org"));
+    CHECK(headerPutUint32(kept, RPMTAG_INSTALLTID, &val, 1));
+    CHECK(headerPutUint32(fresh, RPMTAG_INSTALLTID, &val, 1));
+    CHECK(headerPutString(kept, RPMTAG_VENDOR, "vendor"));
+    CHECK(headerPutString(fresh, RPMTAG_VENDOR, "vendor"));
+    checkSame("put", kept, fresh);
+    checkSame("put again", kept, fresh);
+
+    /* Modifying an added entry, then a region entry */
+    modUint32(kept, RPMTAG_INSTALLTID, 43);
+    modUint32(fresh, RPMTAG_INSTALLTID, 43);
+    checkSame("mod added", kept, fresh);
+    modUint32(kept, RPMTAG_SIZE, 4343);
+    modUint32(fresh, RPMTAG_SIZE, 4343);
+    checkSame("mod region", kept, fresh);
+
+    /* Deleting added and region entries */
+    CHECK(headerDel(kept, RPMTAG_VENDOR) == 0);
+    CHECK(headerDel(fresh, RPMTAG_VENDOR) == 0);
+    checkSame("del added", kept, fresh);
+    CHECK(headerDel(kept, RPMTAG_RELEASE) == 0);
+    CHECK(headerDel(fresh, RPMTAG_RELEASE) == 0);
+    checkSame("del region", kept, fresh);
+    CHECK(headerPutString(kept, RPMTAG_RELEASE, "2"));
+    CHECK(headerPutString(fresh, RPMTAG_RELEASE, "2"));
+    checkSame("put deleted", kept, fresh);
+
+exit:
+    headerFree(kept);
+    headerFree(fresh);
+}
+
+int main(void)
+{
+    Header h = headerNew();
+    uint32_t val = 4242;
+    unsigned int size = 0;
+    void *blob;
+
+    headerPutString(h, RPMTAG_NAME, "keep");
+    headerPutString(h, RPMTAG_VERSION, "1.0");
+    headerPutString(h, RPMTAG_RELEASE, "1");
+    headerPutString(h, RPMTAG_SUMMARY, "kept header export");
+    headerPutUint32(h, RPMTAG_SIZE, &val, 1);
+    h = headerReload(h, RPMTAG_HEADERIMMUTABLE);
+
+    /* One dribble replacing a region entry, one new */
+    headerDel(h, RPMTAG_VERSION);
+    headerPutString(h, RPMTAG_VERSION, "2.0");
+    headerPutUint32(h, RPMTAG_INSTALLTIME, &val, 1);
+    blob = headerExport(h, &size);
+    headerFree(h);
+
+    if (blob == NULL)
+	return 1;
+
+    checkKeep(blob, size);
+
+    free(blob);
+    return failures ? 1 : 0;
+}
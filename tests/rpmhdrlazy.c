@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include <rpm/header.h>
+#include <rpm/rpmtag.h>
+
+struct entry {
+    int32_t tag;
+    int32_t type;
+    int32_t offset;
+    uint32_t count;
+};
+
+static int failures = 0;
+
+#define CHECK(_cond) \
+    do { if (!(_cond)) { \
+	printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #_cond); \
+	failures++; \
+    } } while (0)
+
+static struct entry *blobIndex(void *blob)
+{
+    return (struct entry *)((uint32_t *)blob + 2);
+}
+
+/* Number of entries covered by the region, region tag included */
+static uint32_t blobRegionCount(void *blob)
+{
+    struct entry *pe = blobIndex(blob);
+    uint32_t il = ntohl(((uint32_t *)blob)[0]);
+    char *dataStart = (char *)(pe + il);
+    struct entry trailer;
+
+    memcpy(&trailer, dataStart + ntohl(pe[0].offset), sizeof(trailer));
+    return -(int32_t)ntohl(trailer.offset) / sizeof(trailer);
+}
+
+static struct entry *blobFind(void *blob, uint32_t first, rpmTagVal tag)
+{
+    struct entry *pe = blobIndex(blob);
+    uint32_t il = ntohl(((uint32_t *)blob)[0]);
+
+    for (uint32_t i = first; i < il; i++) {
+	if (ntohl(pe[i].tag) == tag)
+	    return &pe[i];
+    }
+    return NULL;
+}
+
+static void *blobDup(const void *blob, unsigned int size)
+{
+    return memcpy(malloc(size), blob, size);
+}
+
+/* Lazy and eager imports must agree on the tag values and export */
+static void checkSame(void *blob, unsigned int size)
+{
+    Header lazy = headerImport(blob, size,
+			       HEADERIMPORT_COPY | HEADERIMPORT_LAZY);
+    Header eager = headerImport(blob, size, HEADERIMPORT_COPY);
+    unsigned int lsize = 0, esize = 0;
+    void *lblob, *eblob;
+
+    CHECK(lazy != NULL && eager != NULL);
+    if (lazy == NULL || eager == NULL)
+	return;
+
+    CHECK(!strcmp(headerGetString(lazy, RPMTAG_NAME), "lazy"));
+    CHECK(!strcmp(headerGetString(lazy, RPMTAG_VERSION), "2.0"));
+    CHECK(!strcmp(headerGetString(lazy, RPMTAG_URL), "https://rpm.org"));
+    CHECK(headerGetNumber(lazy, RPMTAG_SIZE) == 4242);
+    CHECK(headerIsEntry(lazy, RPMTAG_SUMMARY));
+
+    lblob = headerExport(lazy, &lsize);
+    eblob = headerExport(eager, &esize);
+    CHECK(lblob && eblob && lsize == esize && !memcmp(lblob, eblob, lsize));
+
+    free(lblob);
+    free(eblob);
+    headerFree(lazy);
+    headerFree(eager);
+}
+
+/* Dribble data must not point back into the region */
+static void checkOverlap(void *blob, unsigned int size)
+{
+    void *b = blobDup(blob, size);
+    struct entry *region = blobFind(b, 1, RPMTAG_VERSION);
+    struct entry *dribble = blobFind(b, blobRegionCount(b), RPMTAG_VERSION);
+
+    CHECK(region != NULL && dribble != NULL && region != dribble);
+    if (region == NULL || dribble == NULL)
+	goto exit;
+
+    /* Same length as the dribble data, so only the overlap is wrong */
+    dribble->offset = region->offset;
+    CHECK(headerImport(b, size, HEADERIMPORT_COPY) == NULL);
+    CHECK(headerImport(b, size, HEADERIMPORT_COPY | HEADERIMPORT_LAZY) == NULL);
+
+exit:
+    free(b);
+}
+
+/* Corrupt region entries vanish on first access, whichever call it is */
+static void checkCorrupt(void *blob, unsigned int size, int del)
+{
+    void *b = blobDup(blob, size);
+    struct entry *pe = blobFind(b, 1, RPMTAG_SUMMARY);
+    Header h;
+
+    CHECK(pe != NULL);
+    if (pe == NULL)
+	goto exit;
+    pe->type = htonl(RPM_MAX_TYPE + 1);
+    CHECK(headerImport(b, size, HEADERIMPORT_COPY) == NULL);
+
+    h = headerImport(b, size, HEADERIMPORT_COPY | HEADERIMPORT_LAZY);
+    CHECK(h != NULL);
+    if (h == NULL)
+	goto exit;
+
+    if (!del) {
+	CHECK(headerGetString(h, RPMTAG_SUMMARY) == NULL);
+	CHECK(!headerIsEntry(h, RPMTAG_SUMMARY));
+	/* A new value is found, not hidden by the corrupt entry */
+	CHECK(headerPutString(h, RPMTAG_SUMMARY, "new summary"));
+	CHECK(!strcmp(headerGetString(h, RPMTAG_SUMMARY), "new summary"));
+    }
+    /* Deleting drops the corrupt entry too */
+    CHECK(headerDel(h, RPMTAG_SUMMARY) == 0);
+    CHECK(headerGetString(h, RPMTAG_SUMMARY) == NULL);
+    CHECK(!strcmp(headerGetString(h, RPMTAG_NAME), "lazy"));
+
+    /* The region is exported as is, corrupt entry included */
+    CHECK(headerExport(h, NULL) == NULL);
+    headerFree(h);
+
+exit:
+    free(b);
+}
+
+/* Dribbles replacing corrupt region entries fail import as eager does */
+static void checkCorruptReplaced(void *blob, unsigned int size)
+{
+    void *b = blobDup(blob, size);
+    struct entry *pe = blobFind(b, 1, RPMTAG_VERSION);
+
+    CHECK(pe != NULL);
+    if (pe == NULL)
+	goto exit;
+    pe->type = htonl(RPM_MAX_TYPE + 1);
+    CHECK(headerImport(b, size, HEADERIMPORT_COPY) == NULL);
+    CHECK(headerImport(b, size, HEADERIMPORT_COPY | HEADERIMPORT_LAZY) == NULL);
+
+exit:
+    free(b);
+}
+
+/* Entries added after import reuse index slots, they must not look lazy */
+static void checkAdded(void *blob, unsigned int size)
+{
+    Header h = headerImport(blob, size, HEADERIMPORT_COPY | HEADERIMPORT_LAZY);
+    struct rpmtd_s td;
+
+    CHECK(h != NULL);
+    if (h == NULL)
+	return;
+
+    /* Leaves a copy of the undecoded last entry past the end */
+    CHECK(headerDel(h, RPMTAG_NAME) == 0);
+    CHECK(headerPutString(h, RPMTAG_URL, "https://rpm.org"));
+
+    CHECK(headerGet(h, RPMTAG_URL, &td, HEADERGET_MINMEM));
+    CHECK(td.type == RPM_STRING_TYPE &&
+	  !strcmp(rpmtdGetString(&td), "https://rpm.org"));
+    rpmtdFreeData(&td);
+    CHECK(headerGetNumber(h, RPMTAG_SIZE) == 4242);
+
+    headerFree(h);
+}
+
+int main(void)
+{
+    Header h = headerNew();
+    uint32_t val = 4242;
+    unsigned int rsize = 0, dsize = 0;
+    void *region, *dribbles;
+
+    headerPutString(h, RPMTAG_NAME, "lazy");
+    headerPutString(h, RPMTAG_VERSION, "1.0");
+    headerPutString(h, RPMTAG_RELEASE, "1");
+    headerPutString(h, RPMTAG_SUMMARY, "lazily imported header");
+    headerPutUint32(h, RPMTAG_SIZE, &val, 1);
+    h = headerReload(h, RPMTAG_HEADERIMMUTABLE);
+    region = headerExport(h, &rsize);
+
+    /* One dribble replacing a region entry, one new */
+    headerDel(h, RPMTAG_VERSION);
+    headerPutString(h, RPMTAG_VERSION, "2.0");
+    headerPutString(h, RPMTAG_URL, "https://rpm.org");
+    dribbles = headerExport(h, &dsize);
+    headerFree(h);
+
+    if (region == NULL || dribbles == NULL)
+	return 1;
+
+    checkSame(dribbles, dsize);
+    checkOverlap(dribbles, dsize);
+    checkCorrupt(region, rsize, 0);
+    checkCorrupt(region, rsize, 1);
+    checkCorruptReplaced(dribbles, dsize);
+    checkAdded(region, rsize);
+
+    free(region);
+    free(dribbles);
+    return failures ? 1 : 0;
+}
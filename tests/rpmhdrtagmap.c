@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rpm/header.h>
+#include <rpm/rpmtag.h>
+#include <rpm/rpmtd.h>
+
+static int failures = 0;
+
+#define CHECK(_cond) \
+    do { if (!(_cond)) { \
+	printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #_cond); \
+	failures++; \
+    } } while (0)
+
+/* Tag ranges to look up: in and around both tag map ranges */
+static const rpmTagVal ranges[][2] = {
+    { RPMTAG_HEADERI18NTABLE, RPMTAG_HEADERI18NTABLE + 300 },
+    { RPMTAG_NAME - 10, RPMTAG_NAME + 300 },
+    { RPMTAG_FILENAMES - 10, RPMTAG_FILENAMES + 200 },
+};
+
+/* Find the last entry of a tag by walking all of the header */
+static int scanTag(Header h, rpmTagVal tag, rpmtd found)
+{
+    HeaderIterator hi = headerInitIterator(h);
+    struct rpmtd_s td;
+    int rc = 0;
+
+    rpmtdReset(found);
+    while (headerNext(hi, &td)) {
+	if (td.tag == tag) {
+	    rpmtdFreeData(found);
+	    *found = td;
+	    rc = 1;
+	} else {
+	    rpmtdFreeData(&td);
+	}
+    }
+    headerFreeIterator(hi);
+    return rc;
+}
+
+static int tdEqual(rpmtd a, rpmtd b)
+{
+    if (a->type != b->type || rpmtdCount(a) != rpmtdCount(b))
+	return 0;
+
+    switch (rpmtdClass(a)) {
+    case RPM_BINARY_CLASS:
+	return (memcmp(a->data, b->data, rpmtdCount(a)) == 0);
+    case RPM_STRING_CLASS:
+	while (rpmtdNext(a) >= 0 && rpmtdNext(b) >= 0) {
+	    if (strcmp(rpmtdGetString(a), rpmtdGetString(b)))
+		return 0;
+	}
+	break;
+    default:
+	while (rpmtdNext(a) >= 0 && rpmtdNext(b) >= 0) {
+	    if (rpmtdGetNumber(a) != rpmtdGetNumber(b))
+		return 0;
+	}
+	break;
+    }
+    return 1;
+}
+
+/* Lookups of the tag must agree with a linear scan of the header */
+static void checkTag(const char *step, Header h, rpmTagVal tag)
+{
+    struct rpmtd_s found, got;
+    int isfound = scanTag(h, tag, &found);
+    int isgot = headerGet(h, tag, &got, HEADERGET_MINMEM | HEADERGET_RAW);
+
+    if (headerIsEntry(h, tag) != isfound || isgot != isfound ||
+	    (isfound && !tdEqual(&found, &got))) {
+	printf("%s: tag %d: scan %d, get %d, isentry %d\n", step, tag,
+		isfound, isgot, headerIsEntry(h, tag));
+	failures++;
+    }
+    rpmtdFreeData(&found);
+    rpmtdFreeData(&got);
+}
+
+static void checkHeader(const char *step, Header h)
+{
+    HeaderIterator hi = headerInitIterator(h);
+    rpmTagVal tag, prev = 0;
+    int nr = sizeof(ranges) / sizeof(ranges[0]);
+
+    /* The walk itself must come in tag order */
+    while ((tag = headerNextTag(hi)) != RPMTAG_NOT_FOUND) {
+	CHECK(tag >= prev);
+	prev = tag;
+    }
+    headerFreeIterator(hi);
+
+    for (int r = 0; r < nr; r++) {
+	for (tag = ranges[r][0]; tag < ranges[r][1]; tag++) {
+	    /* Regions are not seen by iterators */
+	    if (tag >= RPMTAG_HEADERIMAGE && tag <= RPMTAG_HEADERIMMUTABLE)
+		continue;
+	    checkTag(step, h, tag);
+	}
+    }
+}
+
+static void checkChanges(const char *step, Header h)
+{
+    const char *files[] = { "a", "b" };
+    uint32_t val = 7;
+    char buf[64];
+
+    checkHeader(step, h);
+
+    /* Region entries, inside and outside of the map */
+    CHECK(headerDel(h, RPMTAG_VERSION) == 0);
+    CHECK(headerDel(h, RPMTAG_SHA256HEADER) == 0);
+    CHECK(headerDel(h, RPMTAG_ENCODING) == 0);
+    CHECK(headerDel(h, RPMTAG_ENCODING) == 1);
+    snprintf(buf, sizeof(buf), "%s del", step);
+    checkHeader(buf, h);
+
+    /* Deleted again, new in order, new out of order and appended to */
+    CHECK(headerPutString(h, RPMTAG_VERSION, "2.0"));
+    CHECK(headerPutString(h, RPMTAG_SHA256HEADER, "cafe"));
+    CHECK(headerPutString(h, RPMTAG_PAYLOADCOMPRESSOR, "zstd"));
+    CHECK(headerPutUint32(h, RPMTAG_PAYLOADDICTID, &val, 1));
+    CHECK(headerPutUint32(h, RPMTAG_EPOCH, &val, 1));
+    CHECK(headerPutString(h, RPMTAG_SHA1HEADER, "beef"));
+    CHECK(headerPutStringArray(h, RPMTAG_BASENAMES, files, 2));
+    snprintf(buf, sizeof(buf), "%s put", step);
+    checkHeader(buf, h);
+
+    /* Deleting everything of a tag with several entries */
+    CHECK(headerPutString(h, RPMTAG_RELEASE, "2"));
+    CHECK(headerDel(h, RPMTAG_RELEASE) == 0);
+    CHECK(headerDel(h, RPMTAG_RELEASE) == 1);
+    snprintf(buf, sizeof(buf), "%s del again", step);
+    checkHeader(buf, h);
+}
+
+static Header newHeader(void)
+{
+    Header h = headerNew();
+    const char *names[] = { "foo", "bar", "baz" };
+    const char *dirs[] = { "/usr/bin/" };
+    uint32_t dirindexes[] = { 0, 0, 0 };
+    uint32_t val = 4242;
+    uint8_t bin[] = { 1, 2, 3, 4 };
+
+    headerPutString(h, RPMTAG_NAME, "tagmap");
+    headerPutString(h, RPMTAG_VERSION, "1.0");
+    headerPutString(h, RPMTAG_RELEASE, "1");
+    headerPutString(h, RPMTAG_SUMMARY, "tag map lookups");
+    headerPutString(h, RPMTAG_ARCH, "noarch");
+    headerPutUint32(h, RPMTAG_SIZE, &val, 1);
+    headerPutStringArray(h, RPMTAG_BASENAMES, names, 3);
+    headerPutStringArray(h, RPMTAG_DIRNAMES, dirs, 1);
+    headerPutUint32(h, RPMTAG_DIRINDEXES, dirindexes, 3);
+    headerPutStringArray(h, RPMTAG_PROVIDENAME, names, 3);
+    headerPutBin(h, RPMTAG_SIGMD5, bin, sizeof(bin));
+    headerPutString(h, RPMTAG_SHA256HEADER, "0123");
+    headerPutString(h, RPMTAG_ENCODING, "utf-8");
+    headerPutString(h, RPMTAG_PAYLOADDIGESTALGO, "sha256");
+    return h;
+}
+
+int main(void)
+{
+    Header h = newHeader();
+    Header big = headerNew();
+    unsigned int size = 0;
+    uint32_t val = 0;
+    void *blob;
+
+    checkChanges("new", h);
+    headerFree(h);
+
+    h = headerReload(newHeader(), RPMTAG_HEADERIMMUTABLE);
+    CHECK(h != NULL);
+    blob = headerExport(h, &size);
+    headerFree(h);
+    CHECK(blob != NULL);
+
+    if (blob) {
+	h = headerImport(blob, size, HEADERIMPORT_COPY);
+	checkChanges("import", h);
+	headerFree(h);
+
+	h = headerImport(blob, size, HEADERIMPORT_COPY | HEADERIMPORT_LAZY);
+	checkChanges("lazy import", h);
+	headerFree(h);
+	free(blob);
+    }
+
+    /* Too many entries for the map, lookups fall back to searching */
+    headerPutString(big, RPMTAG_NAME, "big");
+    for (val = 0; val <= UINT16_MAX; val++)
+	headerPutUint32(big, RPMTAG_SIZE, &val, 1);
+    headerPutString(big, RPMTAG_SHA1HEADER, "beef");
+    headerPutString(big, RPMTAG_VERSION, "1.0");
+    checkTag("big", big, RPMTAG_NAME);
+    checkTag("big", big, RPMTAG_SIZE);
+    checkTag("big", big, RPMTAG_VERSION);
+    checkTag("big", big, RPMTAG_SHA1HEADER);
+    CHECK(headerDel(big, RPMTAG_SIZE) == 0);
+    checkTag("big del", big, RPMTAG_SIZE);
+    checkTag("big del", big, RPMTAG_VERSION);
+    headerFree(big);
+
+    return failures ? 1 : 0;
+}